@@ -0,0 +1,81 @@
+#ifndef ANALYSISFRAME_H
+#define ANALYSISFRAME_H
+
+#include <Arduino.h>
+
+/* Result of analysing one block, published once per frame for the effects */
+struct AnalysisFrame
+{
+    static const uint8_t kBandCount = 64;
+
+    uint32_t timestamp; // End of the I2S read of the block [us]
+    uint32_t sequence;  // Number of the analysed block
+    uint8_t lightness[kBandCount];
+    bool isBeatHit;
+
+    float rms;          // Of the DC free block, 1.0 = full scale
+    float peak;         // Largest absolute sample, 1.0 = full scale
+    float centroidHz;   // Magnitude weighted mean frequency
+    float rolloffHz;    // 85 % of the spectral magnitude lies below
+    float flux;         // Rise of the spectrum above its average, relative to the magnitude sum
+    float flatness;     // Geometric over arithmetic mean, 0 = pure tones, 1 = white noise
+    float magnitudeSum; // Sum of the averaged spectrum
+    float sensitivity;  // Factor from band magnitude to lightness
+};
+
+// log2 from the float exponent and a quadratic fit of the mantissa, error below 0.005
+inline float fastLog2(float x)
+{
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    float exponent = (int32_t)((bits >> 23) & 0xFF) - 128; // The fit below adds the missing 1
+
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    float mantissa;
+    memcpy(&mantissa, &bits, sizeof(mantissa));
+
+    return exponent + (-0.34484843f * mantissa + 2.02466578f) * mantissa - 0.67487759f;
+}
+
+/*
+    Spectral features accumulated bin by bin inside the magnitude loop, so no
+    extra pass over the spectrum is needed. The rolloff has to know the total
+    before the pass; it uses the total of the previous frame, which the
+    averaged spectrum keeps close to the current one.
+*/
+class SpectrumFeatures
+{
+private:
+    float sum_ = 0.0f;
+    float weightedSum_ = 0.0f;
+    float fluxSum_ = 0.0f;
+    float logSum_ = 0.0f;
+    float binIdx_ = 0.0f;
+    uint16_t rolloffBins_ = 0;
+    float rolloffThreshold_ = 0.0f;
+
+public:
+    static const float kRolloffShare;
+    static const float kMagnitudeFloor; // Keeps log2 finite for empty bins
+
+    void begin();
+
+    // 'magnitude' is the averaged bin, 'rise' the new magnitude minus the previous average
+    void add(float magnitude, float rise)
+    {
+        sum_ += magnitude;
+        weightedSum_ += binIdx_ * magnitude;
+        fluxSum_ += fmaxf(rise, 0.0f);
+        logSum_ += fastLog2(magnitude + kMagnitudeFloor);
+        rolloffBins_ += (sum_ < rolloffThreshold_);
+        binIdx_ += 1.0f;
+    }
+
+    float sum() const { return sum_; }
+
+    // Fill the spectral fields of the frame
+    void finish(AnalysisFrame &frame, float freqStep);
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef AUDIOCAPTURE_H
+#define AUDIOCAPTURE_H
+
+#include <Arduino.h>
+
+/*
+    Lossless raw-audio frame, all fields little endian:
+
+    offset  size  field
+    0       2     sync word 0xA5 0xC3
+    2       1     frame type (kAudioTypeBlock)
+    3       2     payload length P
+    5       4     block sequence number
+    9       4     timestamp [us]
+    13      2     sample count N
+    15      1     coding (AudioCoding)
+    16      1     Rice parameter k
+    17      2     first sample
+    19      ...   Rice: zigzag coded sample deltas, MSB first
+                  Verbatim: samples 1..N-1 as int16
+    5+P     2     CRC-16/CCITT-FALSE over type, length and payload
+
+    Each block restarts the delta prediction, so the decoder can resynchronize
+    at any frame and detect gaps from the sequence number.
+*/
+const uint8_t kAudioSync0 = 0xA5;
+const uint8_t kAudioSync1 = 0xC3;
+const uint8_t kAudioTypeBlock = 2;
+const uint8_t kAudioHeaderSize = 5 + 14;
+const uint8_t kRiceEscapeLength = 24; // Unary prefixes this long are followed by the raw 17-bit value
+
+enum class AudioCoding : uint8_t
+{
+    Rice,
+    Verbatim
+};
+
+// Encode a block into 'buffer', returns the frame size or 0 if it does not fit
+size_t encodeAudioBlock(uint8_t *buffer, size_t size, uint32_t sequence, uint32_t timestamp,
+                        const int16_t *samples, uint16_t count);
+
+// Worst case frame size, reached when the block is stored verbatim
+inline size_t audioFrameMaxSize(uint16_t count) { return kAudioHeaderSize + 2 * count + 2; }
+
+/* Streams every microphone block through the telemetry writer */
+class AudioCapture
+{
+private:
+    static const uint16_t kMaxBlockSamples = 4096;
+
+    uint8_t frame_[kAudioHeaderSize + 2 * kMaxBlockSamples + 2];
+    uint32_t sequence_ = 0;
+    uint32_t rawBytes_ = 0;
+    uint32_t encodedBytes_ = 0;
+
+public:
+    void capture(const int16_t *samples, uint16_t count, uint32_t timestamp);
+
+    // Encoded size relative to the raw samples in percent
+    uint8_t compressionRatio() const { return rawBytes_ ? (uint64_t)encodedBytes_ * 100 / rawBytes_ : 0; }
+};
+
+#ifdef AUDIOVIS_RAW_CAPTURE
+extern AudioCapture audioCapture;
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef BANDTABLE_H
+#define BANDTABLE_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+/*
+    Assignment of FFT bins to frequency bands, with the gain of each band.
+
+    Each band is a triangular filter that peaks at the center of the band and
+    falls to zero at the centers of its neighbours, so a peak moving across a
+    band edge fades from one band into the next instead of jumping. The
+    filters are stored as a sparse matrix: band b covers filterLength[b] bins
+    from filterStart[b], with 8-bit weights from weights[filterOffset[b]].
+    norm[b] is the inverse of the highest weight of the filter, so a tone at
+    the peak of a filter reads its own magnitude, as the maximum over the band
+    did before, however wide the band is.
+*/
+struct BandTable
+{
+    static const uint8_t kBandCount = 64;
+    static const uint16_t kMaxWeights = 3072; // About 2100 for the default bands at 4096 points
+
+    uint16_t binIdxStart[kBandCount]; // First frequency bin of the band
+    uint16_t binIdxEnd[kBandCount];   // Last frequency bin of the band
+    float gain[kBandCount];
+    float endHz[kBandCount]; // Upper edge of the band
+
+    uint16_t filterStart[kBandCount];
+    uint16_t filterLength[kBandCount];
+    uint16_t filterOffset[kBandCount];
+    float norm[kBandCount];
+    uint8_t weights[kMaxWeights];
+
+    // Magnitude of a band: the dot product of its filter with the magnitude spectrum
+    float magnitude(uint8_t band, const float *spectrum) const
+    {
+        const uint8_t *weight = weights + filterOffset[band];
+        const float *bin = spectrum + filterStart[band];
+        float sum = 0.0f;
+
+        for (uint16_t i = 0; i < filterLength[band]; i++)
+        {
+            sum += weight[i] * bin[i];
+        }
+
+        return sum * norm[band];
+    }
+};
+
+/*
+    Band tables that can be replaced while the analyzer is running.
+
+    Writers (BLE callbacks, presets) build a new table in a spare slot and
+    publish it with an atomic pointer store. The analyzer takes the current
+    table once per frame with acquire() and hands it back with release(), so a
+    frame never sees a partly built table and never waits for a writer. Three
+    slots guarantee that a writer always finds one that is neither published
+    nor still read by the analyzer.
+*/
+class BandTables
+{
+private:
+    static const uint8_t kSlotCount = 3;
+
+    BandTable tables_[kSlotCount] = {};
+    std::atomic<BandTable *> active_;
+    std::atomic<BandTable *> inUse_; // Table of the frame in progress, protected from writers
+    SemaphoreHandle_t writerMutex_ = nullptr;
+
+    float startHz_ = 0.0f;
+    float freqStep_ = 1.0f;
+    uint16_t binCount_ = 0;
+    uint32_t swapCount_ = 0;
+
+    bool build(BandTable &table, const float *endHz, const float *gain) const;
+    bool buildFilters(BandTable &table) const;
+    bool publish(const float *endHz, const float *gain);
+
+public:
+    BandTables() : active_(&tables_[0]), inUse_(&tables_[0]) {}
+
+    // FFT resolution the tables are built for
+    bool begin(float startHz, float freqStep, uint16_t binCount);
+
+    // Writers, may block on each other but never on the analyzer
+    bool update(const float *endHz, const float *gain);
+    bool updateGains(const float *gain);
+
+    // Rebuild the current bands for another FFT size, keeps the old one if they do not fit
+    bool setResolution(float freqStep, uint16_t binCount);
+
+    // Analyzer, once at the start of each frame; the table stays valid until release()
+    const BandTable &acquire();
+    void release() { inUse_.store(nullptr); }
+
+    const BandTable &current() const { return *active_.load(); }
+    uint32_t swapCount() const { return swapCount_; }
+};
+
+#endif
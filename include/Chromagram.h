@@ -0,0 +1,53 @@
+#ifndef CHROMAGRAM_H
+#define CHROMAGRAM_H
+
+#include <Arduino.h>
+
+/*
+    Energy per pitch class (C, C#, ... B) of the averaged spectrum.
+
+    A table built once maps every FFT bin to its nearest pitch class, so the
+    spectrum loop adds each bin with one table lookup and no branch. Bins too
+    wide to resolve a semitone, or above the musical range, go to a discard
+    slot. At the end of the frame the energies are smoothed and the dominant
+    pitch class is picked with hysteresis, so the hue follows the harmony but
+    does not jump between two equally loud notes.
+*/
+class Chromagram
+{
+public:
+    static const uint8_t kPitchClassCount = 12;
+    static const uint16_t kMaxBins = 2048;
+
+private:
+    uint8_t pitchClass_[kMaxBins];              // kPitchClassCount marks bins that are not used
+    float energy_[kPitchClassCount + 1] = {0};  // Current frame, the last slot is the discard slot
+    float smoothed_[kPitchClassCount] = {0};
+    uint8_t level_[kPitchClassCount] = {0};
+    uint8_t dominant_ = 0;
+    uint8_t hue_ = 0;
+
+public:
+    float smoothing = 0.1f;    // Weight of the current frame
+    float switchMargin = 1.3f; // A new dominant pitch class must be this much louder than the current one
+    uint8_t hueRate = 3;       // Hue moves 1/2^hueRate of the remaining distance per frame
+
+    bool begin(float freqStep, uint16_t binCount, float maxHz = 5000.0f);
+
+    // Called for every bin of the spectrum
+    void add(uint16_t binIdx, float magnitude) { energy_[pitchClass_[binIdx]] += magnitude; }
+
+    // Called once per frame after all bins were added
+    void update();
+
+    // Smoothed energy per pitch class relative to the loudest one (0..255)
+    const uint8_t *levels() const { return level_; }
+
+    // Pitch class with the most energy, 0 = C
+    uint8_t dominant() const { return dominant_; }
+
+    // Hue of the dominant pitch class on the circle of fifths, so related keys get similar colors
+    uint8_t hue() const { return hue_; }
+};
+
+#endif
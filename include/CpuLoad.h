@@ -0,0 +1,29 @@
+#ifndef CPULOAD_H
+#define CPULOAD_H
+
+#include <Arduino.h>
+
+/*
+    CPU utilization of both cores. The FreeRTOS tick hook of each core checks
+    whether the idle task was interrupted; over a window of kWindowTicks ticks
+    the share of such ticks is the idle time of that core. Sampling costs a
+    compare per tick and resolves a core's load in steps of 1 / kWindowTicks.
+*/
+class CpuLoad
+{
+public:
+    static const uint8_t kCoreCount = 2;
+    static const uint16_t kWindowTicks = 1000; // One second at the default tick rate
+
+    bool begin();
+
+    // Busy share of the last complete window [%]
+    uint8_t percent(uint8_t core) const;
+
+    // One line with the load of every core, returns the number of characters written
+    size_t format(char *buffer, size_t size) const;
+};
+
+extern CpuLoad cpuLoad;
+
+#endif
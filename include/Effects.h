@@ -0,0 +1,300 @@
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include <Arduino.h>
+#include <FastLED.h>
+#include <tuple>
+#include "AnalysisFrame.h"
+#include "Chromagram.h"
+#include "MatrixLayout.h"
+#include "Palette.h"
+#include "Particles.h"
+#include "PowerLimiter.h"
+#include "StripLayout.h"
+#include "VuDynamics.h"
+
+/* Per-frame input shared by all effects and modifiers */
+struct EffectContext
+{
+    const StripLayout *layout;
+    const MatrixLayout *matrix;    // Pixel grid of a matrix segment, nullptr for strips
+    const CRGBPalette256 *palette; // Compiled palette, set by the engine
+    const uint8_t *lightness; // Lightness of each frequency band
+    const uint8_t *peaks;     // Peak-hold markers of the bands, nullptr unless VU dynamics are enabled
+    uint8_t beatIntensity; // Decaying beat indicator (0..250)
+    uint8_t beatModifier;  // Toggles every 8 beats
+    const AnalysisFrame *analysis; // Features of the current block, nullptr while idle
+    const Chromagram *chroma; // Pitch classes of the spectrum, nullptr while idle
+    PowerMeter *power;     // Accumulates the load of every pixel written
+};
+
+/* Render time counters of a single effect or modifier */
+struct LayerStats
+{
+    uint32_t frames;
+    uint32_t lastMicros;
+    uint32_t maxMicros;
+    uint32_t totalMicros;
+};
+
+/*
+    Effects and modifiers are plain classes providing 'renderFrame()' and 'name()'.
+    They are dispatched once per frame through a LayerRegistry, so the pixel loop
+    inside each effect is never behind a virtual call.
+*/
+template <typename Derived>
+class Layer
+{
+public:
+    void render(const EffectContext &ctx, CRGB *leds)
+    {
+        static_cast<Derived *>(this)->renderFrame(ctx, leds);
+    }
+};
+
+/* ----- Primary effects ----- */
+
+class DefaultSoundFx : public Layer<DefaultSoundFx>
+{
+public:
+    static const char *name() { return "default"; }
+    void renderFrame(const EffectContext &ctx, CRGB *leds);
+
+    uint8_t bassHue = 160;    // Blueish
+    bool followPitch = false; // Rotate the palette with the hue of the dominant pitch class
+};
+
+class TwoToneSoundFx : public Layer<TwoToneSoundFx>
+{
+public:
+    static const char *name() { return "twotone"; }
+    void renderFrame(const EffectContext &ctx, CRGB *leds);
+
+    uint8_t bassHue = 160; // Blueish
+    uint8_t colorStep = 1; // Palette index increment per band within a group
+};
+
+class SolidFx : public Layer<SolidFx>
+{
+public:
+    static const char *name() { return "solid"; }
+    void renderFrame(const EffectContext &ctx, CRGB *leds);
+
+    uint8_t hue = 0;
+    uint8_t saturation = 255;
+    uint8_t brightness = 0;
+};
+
+class OffFx : public Layer<OffFx>
+{
+public:
+    static const char *name() { return "off"; }
+    void renderFrame(const EffectContext &ctx, CRGB *leds);
+};
+
+/*
+    Scrolling spectrogram for matrix segments: every frame adds a row of band
+    levels at the top and older rows move down. The rows are kept in a ring
+    buffer and only the offset of the newest row moves, so scrolling never
+    copies the history. Columns run from the bass to the treble and take the
+    highest of their bands. Renders black on strips.
+*/
+class WaterfallFx : public Layer<WaterfallFx>
+{
+private:
+    uint8_t history_[MatrixLayout::kMaxHeight][MatrixLayout::kMaxWidth] = {};
+    uint8_t newestRow_ = 0;
+
+public:
+    static const char *name() { return "waterfall"; }
+    void renderFrame(const EffectContext &ctx, CRGB *leds);
+
+    uint8_t hueSpan = 255; // Palette range spread over the columns
+};
+
+// Slow breathing glow through the palette, shown instead of sound-reactive effects while idle
+class IdleFx : public Layer<IdleFx>
+{
+private:
+    uint8_t phase_ = 0;
+    uint8_t drift_ = 0;
+
+public:
+    static const char *name() { return "idle"; }
+    void renderFrame(const EffectContext &ctx, CRGB *leds);
+
+    uint8_t maxBrightness = 48;
+};
+
+/* ----- Modifiers, rendered on top of the primary effect ----- */
+
+// Sparkles drawn from a particle pool, emitted on beats, by loud bands and at random
+class SparkleModifier : public Layer<SparkleModifier>
+{
+private:
+    ParticleSystem particles_;
+    FastRandom rng_;
+    bool isSeeded_ = false;
+    uint8_t lastBeatIntensity_ = 0;
+    uint8_t ambientDelay_ = 0;
+
+public:
+    static const char *name() { return "sparkle"; }
+    void renderFrame(const EffectContext &ctx, CRGB *leds);
+
+    uint8_t beatBurst = 24;     // Particles emitted on each beat
+    uint8_t bandProbes = 8;     // LEDs tested for band-triggered emission per frame
+    uint8_t bandThreshold = 96; // Minimum band lightness for emission
+
+    uint16_t activeParticles() const { return particles_.count(); }
+};
+
+/* ----- Compile-time registry ----- */
+
+template <uint8_t I, typename Tuple, bool End = (I == std::tuple_size<Tuple>::value)>
+struct LayerDispatch
+{
+    static void render(Tuple &layers, uint8_t id, const EffectContext &ctx, CRGB *leds)
+    {
+        if (id == I)
+            std::get<I>(layers).render(ctx, leds);
+        else
+            LayerDispatch<I + 1, Tuple>::render(layers, id, ctx, leds);
+    }
+
+    static const char *name(uint8_t id)
+    {
+        return (id == I) ? std::tuple_element<I, Tuple>::type::name() : LayerDispatch<I + 1, Tuple>::name(id);
+    }
+};
+
+template <uint8_t I, typename Tuple>
+struct LayerDispatch<I, Tuple, true>
+{
+    static void render(Tuple &, uint8_t, const EffectContext &, CRGB *) {}
+    static const char *name(uint8_t) { return "?"; }
+};
+
+template <typename... Layers>
+class LayerRegistry
+{
+private:
+    typedef std::tuple<Layers...> Tuple;
+
+    Tuple layers_;
+    LayerStats stats_[sizeof...(Layers)] = {};
+
+public:
+    static const uint8_t kCount = sizeof...(Layers);
+
+    template <uint8_t Id>
+    using LayerType = typename std::tuple_element<Id, Tuple>::type;
+
+    template <uint8_t Id>
+    LayerType<Id> &get()
+    {
+        return std::get<Id>(layers_);
+    }
+
+    void render(uint8_t id, const EffectContext &ctx, CRGB *leds)
+    {
+        if (id >= kCount)
+            return;
+
+        unsigned long timeStartMicros = micros();
+
+        LayerDispatch<0, Tuple>::render(layers_, id, ctx, leds);
+
+        uint32_t timeDeltaMicros = micros() - timeStartMicros;
+        LayerStats &stats = stats_[id];
+        stats.frames++;
+        stats.lastMicros = timeDeltaMicros;
+        stats.totalMicros += timeDeltaMicros;
+        if (timeDeltaMicros > stats.maxMicros)
+            stats.maxMicros = timeDeltaMicros;
+    }
+
+    const char *name(uint8_t id) const { return LayerDispatch<0, Tuple>::name(id); }
+    const LayerStats &stats(uint8_t id) const { return stats_[id]; }
+};
+
+/* The order of the registered layers must match the ids */
+enum class EffectId : uint8_t
+{
+    Default,
+    TwoTone,
+    Solid,
+    Off,
+    Waterfall, // Matrix segments only
+    Count
+};
+
+enum class ModifierId : uint8_t
+{
+    Sparkle,
+    Count
+};
+
+typedef LayerRegistry<DefaultSoundFx, TwoToneSoundFx, SolidFx, OffFx, WaterfallFx> EffectRegistry;
+typedef LayerRegistry<SparkleModifier> ModifierRegistry;
+
+static_assert(EffectRegistry::kCount == (uint8_t)EffectId::Count, "EffectId does not match EffectRegistry");
+static_assert(ModifierRegistry::kCount == (uint8_t)ModifierId::Count, "ModifierId does not match ModifierRegistry");
+
+class EffectEngine
+{
+private:
+    // Hand the VU levels and peaks instead of the raw lightness to effects that use them
+    void applyDynamics(EffectContext &ctx, EffectId effect) const;
+
+    // Active palette and the one faded out from
+    CRGBPalette256 palettes_[2];
+    uint8_t activePalette_ = 0;
+    PaletteId paletteId_ = PaletteId::Count;
+
+    EffectId fadeFromEffect_ = EffectId::Off;
+    unsigned long fadeStartMillis_ = 0;
+    uint16_t fadeMillis_ = 0; // Zero while no crossfade is running
+
+public:
+    static const uint16_t kDefaultFadeMillis = 800;
+
+    EffectRegistry effects;
+    ModifierRegistry modifiers;
+    IdleFx idle; // Not selectable, rendered by renderIdle()
+    VuDynamics dynamics;
+
+    EffectId activeEffect = EffectId::Off;
+    uint8_t activeModifiers = 0; // Bit mask indexed by ModifierId
+    uint8_t dynamicEffects = 0;  // Bit mask indexed by EffectId, these effects get the VU levels and peaks
+    bool areModifiersSuspended = false; // Overload: active modifiers are kept but not rendered
+
+    // Switch effect and palette, crossfading from the current output
+    void select(EffectId effect, PaletteId palette, uint16_t fadeMillis = kDefaultFadeMillis);
+    void select(EffectId effect, uint16_t fadeMillis = kDefaultFadeMillis) { select(effect, paletteId_, fadeMillis); }
+    PaletteId activePalette() const { return paletteId_; }
+
+    template <EffectId Id>
+    EffectRegistry::LayerType<(uint8_t)Id> &effect()
+    {
+        return effects.get<(uint8_t)Id>();
+    }
+
+    void toggleModifier(ModifierId id) { activeModifiers ^= (1 << (uint8_t)id); }
+    void setDynamics(EffectId id, bool enabled)
+    {
+        dynamicEffects = enabled ? (dynamicEffects | (1 << (uint8_t)id)) : (dynamicEffects & ~(1 << (uint8_t)id));
+    }
+    bool hasDynamics(EffectId id) const { return dynamicEffects & (1 << (uint8_t)id); }
+    bool isModifierActive(ModifierId id) const { return activeModifiers & (1 << (uint8_t)id); }
+
+    // 'fadeBuffer' is a second frame buffer of the same size holding the faded out effect; a palette
+    // change alone renders the effect once through a blend of both palettes and leaves it unused
+    void render(const EffectContext &ctx, CRGB *leds, CRGB *fadeBuffer);
+
+    // Idle frame: static effects are kept, sound-reactive ones are replaced by the idle glow
+    void renderIdle(const EffectContext &ctx, CRGB *leds);
+    void printStats() const;
+};
+
+#endif
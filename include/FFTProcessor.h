@@ -6,6 +6,9 @@
 #include <arduinoFFT.h>
 #include <driver/i2s.h>
 #include <math.h>
+#include "AnalysisFrame.h"
+#include "Chromagram.h"
+#include "Presets.h"
 
 class FFTProcessor
 {
@@ -18,8 +21,51 @@ public:
     void setup();
     void loop();
 
-    int *getLightness();
-    bool getBeatHit();
+    // Lightness, beat and features of the last analysed block
+    const AnalysisFrame &getFrame();
+
+    // Pitch classes and dominant pitch of the averaged spectrum
+    const Chromagram &getChroma();
+
+    // Replace the band edges [Hz] and gains of all 64 bands, takes effect with the next frame
+    bool setBands(const float *endHz, const float *gain);
+    bool setBandGains(const float *gain);
+
+    // Block size as log2 of the sample count (9..12), switched before the next frame
+    void setFftSize(uint8_t sampleCountLog2);
+    uint8_t getFftSize();
+
+    // Overload: run one size above the preferred one without changing getFftSize()
+    void setBlockSizeBoost(bool boosted);
+
+    // Overload: stop refreshing the display
+    void setDisplaySuspended(bool suspended);
+
+    // I2S buffers beyond the expected count at the start of the last frame
+    uint8_t getQueuedBuffers();
+
+    // Time the transform of every block size and print it with resolution and latency
+    void printFftBenchmark();
+
+    // Band gains, beat threshold, sensitivity limit and FFT size of a preset
+    void applyPreset(const Preset &preset);
+    void capturePreset(Preset &preset);
+
+    // Last current reading from the AXP [mA]
+    float getCurrent();
+
+    // The current is shown on the display once it has been enabled
+    void setDisplayEnabled(bool enabled);
+    bool isDisplayEnabled();
+
+    // True while silence reduced the analysis to the block RMS
+    bool isIdle();
+
+    // Print arena size, heap and stack watermarks to serial
+    void printMemoryReport();
+
+    // Print the average current drawn in active and idle mode
+    void printPowerReport();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,47 @@
+#ifndef LEDOUTPUT_H
+#define LEDOUTPUT_H
+
+#include <Arduino.h>
+#include <FastLED.h>
+#include "Effects.h"
+
+/* Physical LED strip attached to its own data pin */
+struct LedSegment
+{
+    uint8_t pin;
+    uint16_t length;
+    uint16_t offset; // First pixel of the segment within the frame buffer
+    bool reversed;   // Data input at the far end, i.e. the segment is mounted the other way round
+    EffectId effect; // Effect shown after power-on
+    uint8_t matrixWidth; // Pixels per row of a matrix panel, 0 for a strip
+    MatrixWiring wiring; // Chain order of a matrix panel, along its rows
+};
+
+/*
+    Registers one FastLED controller per segment. On the ESP32 each controller
+    gets its own RMT channel and FastLED.show() starts all channels before
+    waiting for them, so a frame takes as long as the longest segment.
+*/
+class LedOutput
+{
+public:
+    static const uint8_t kMaxSegments = 4;
+
+private:
+    uint8_t pins_[kMaxSegments] = {0};
+    uint8_t segmentCount_ = 0;
+    uint16_t longestSegment_ = 0;
+
+public:
+    // Rejects segments that do not fit the frame buffer or use a pin that is already driven
+    bool addSegment(const LedSegment &segment, CRGB *frameBuffer, uint16_t frameBufferSize);
+    void show();
+
+    uint8_t segmentCount() const { return segmentCount_; }
+    uint32_t expectedShowMicros() const;
+
+    uint32_t lastShowMicros = 0;
+    uint32_t maxShowMicros = 0;
+};
+
+#endif
@@ -4,22 +4,36 @@
 #include <Arduino.h>
 #include <M5StickCPlus.h>
 #include <FastLED.h>
+#include "AnalysisFrame.h"
+#include "Chromagram.h"
+#include "Presets.h"
 
 class LightingProcessor
 {
-private:
-    void defaultSoundFx();
-    void twoToneSoundFx();
-    void sparkleFx();
-    void constantFx(uint8_t val, uint8_t saturation, uint8_t brightness);
-    void setHSV(u_int8_t index, uint8_t H, uint8_t S, uint8_t V);
-
 public:
     LightingProcessor();
 
     void setupLedStrip();
     void loop();
-    void updateLedStrip(int lightness[], bool isBeatHit, String modifier);
+    void updateLedStrip(const AnalysisFrame &frame, const Chromagram &chroma, String modifier);
+    void updateIdle(String modifier);
+    void printEffectStats();
+
+    // Run a full particle pool on the strip and print the particle updates per millisecond
+    void printParticleBenchmark();
+
+    // Overload: render and show only every n-th analysed frame
+    void setFrameDivider(uint8_t divider);
+
+    // Overload: skip the modifiers of all segments
+    void setModifiersSuspended(bool suspended);
+
+    // Effect, palette, colors and brightness of a preset
+    void applyPreset(const Preset &preset);
+    void capturePreset(Preset &preset);
+
+    // Measured supply current, calibrates the LED power model if enabled
+    void addCurrentMeasurement(float milliamps);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,47 @@
+#ifndef MATRIXLAYOUT_H
+#define MATRIXLAYOUT_H
+
+#include <Arduino.h>
+
+// How the LED chain runs through a panel
+enum class MatrixWiring : uint8_t
+{
+    Progressive, // Every row (or column) starts at the same side
+    Serpentine   // Every second row (or column) runs backwards, i.e. zigzag
+};
+
+/*
+    Pixel grid of an LED matrix panel. The position of every pixel in the LED
+    chain is compiled once at setup into caller-provided storage, so effects
+    address pixels by (x, y) with a single table lookup whatever the wiring.
+    The origin is the corner with the first LED of the chain.
+*/
+class MatrixLayout
+{
+public:
+    static const uint8_t kMaxWidth = 32;
+    static const uint8_t kMaxHeight = 16; // 32x8 and 16x16 panels fit
+
+private:
+    uint16_t *map_ = nullptr;
+    uint8_t width_ = 0;
+    uint8_t height_ = 0;
+
+public:
+    // 'isColumnMajor' for panels whose chain runs along the columns instead of the rows
+    bool build(uint16_t *map, uint8_t width, uint8_t height, MatrixWiring wiring, bool isColumnMajor = false,
+               bool reversed = false);
+
+    bool isValid() const { return map_ != nullptr; }
+    uint8_t width() const { return width_; }
+    uint8_t height() const { return height_; }
+    uint16_t size() const { return width_ * height_; }
+
+    // LED index of the pixel
+    uint16_t index(uint8_t x, uint8_t y) const { return map_[y * width_ + x]; }
+
+    // LED indices of all pixels of row 'y', from x = 0
+    const uint16_t *row(uint8_t y) const { return map_ + y * width_; }
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef OUTPUTCORRECTION_H
+#define OUTPUTCORRECTION_H
+
+#include <Arduino.h>
+#include <FastLED.h>
+
+/*
+    Final pass from the rendered frame to the buffer sent to the LEDs. Each
+    channel goes through its own gamma table with 8 fractional bits, is scaled
+    by the global brightness and gets the rounding error it left in the same
+    pixel in the previous frame added back (temporal error diffusion). Levels
+    between two LED steps thereby average out over a few frames instead of
+    being crushed to the step below.
+
+    The pass costs one table lookup, one multiply and one add per channel; the
+    tables are computed once when the gamma is set.
+*/
+class OutputCorrection
+{
+public:
+    static const uint16_t kMaxLeds = 600;
+    static constexpr float kDefaultGamma = 2.2f;
+
+private:
+    uint16_t gamma_[3][256]; // Output level in 8.8 fixed point, per channel
+    uint8_t *error_ = nullptr; // Rounding error of every channel, 3 per LED
+    uint16_t numLeds_ = 0;
+    float gammaValues_[3] = {1.0f, 1.0f, 1.0f};
+
+public:
+    bool isDithering = true;
+
+    // 'error' holds 3 bytes per LED
+    bool begin(uint8_t *error, uint16_t numLeds);
+
+    // Gamma per channel, 1.0 is linear
+    void setGamma(float red, float green, float blue);
+    void setGamma(float gamma) { setGamma(gamma, gamma, gamma); }
+    float gamma() const { return gammaValues_[1]; }
+
+    // Output level of each value of a channel in 8.8 fixed point, before the brightness
+    const uint16_t *levels(uint8_t channel) const { return gamma_[channel]; }
+
+    // Correct all LEDs from 'in' into 'out', the buffers must not overlap
+    void apply(const CRGB *in, CRGB *out, uint8_t brightness);
+};
+
+#endif
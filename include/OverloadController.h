@@ -0,0 +1,58 @@
+#ifndef OVERLOADCONTROLLER_H
+#define OVERLOADCONTROLLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Work that is given up under load, in this order; each level includes the ones before */
+enum class OverloadLevel : uint8_t
+{
+    Full,        // Everything enabled
+    NoDisplay,   // No LCD refresh
+    NoParticles, // Modifiers (sparkle particles) suspended
+    HalfLedRate, // LEDs rendered and shown every second frame
+    LargerBlock, // FFT block size doubled, halving the per-frame fixed costs
+    Count
+};
+
+/*
+    Decides how much work to give up from the processing time of each frame
+    and the number of I2S buffers that piled up while it ran. A level is given
+    up after 'missesToStepDown' late frames within 'missWindowFrames', or at
+    once when more than one buffer is queued. It is restored after
+    'recoveryFrames' consecutive frames below 'headroomPercent' of the budget.
+*/
+class OverloadController
+{
+private:
+    OverloadLevel level_ = OverloadLevel::Full;
+    uint8_t recentMisses_ = 0;
+    uint16_t windowFrames_ = 0;
+    uint16_t calmFrames_ = 0;
+
+    // Transitions into and out of each level
+    uint32_t entered_[(uint8_t)OverloadLevel::Count] = {0};
+    uint32_t left_[(uint8_t)OverloadLevel::Count] = {0};
+
+    void setLevel(OverloadLevel level);
+
+public:
+    uint8_t missesToStepDown = 2;
+    uint16_t missWindowFrames = 32;
+    uint16_t recoveryFrames = 400; // About 20 s at 2048 samples per frame
+    uint8_t headroomPercent = 70;
+    OverloadLevel maxLevel = OverloadLevel::LargerBlock;
+
+    // Feed one processed frame, returns true if the level changed
+    bool update(uint32_t frameMicros, uint32_t budgetMicros, uint8_t queuedBuffers);
+
+    OverloadLevel level() const { return level_; }
+    bool isAtLeast(OverloadLevel level) const { return level_ >= level; }
+
+    static const char *levelName(OverloadLevel level);
+
+    // Text report with the current level and the transition counters
+    size_t format(char *buffer, size_t size) const;
+};
+
+#endif
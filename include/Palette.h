@@ -0,0 +1,34 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <Arduino.h>
+#include <FastLED.h>
+
+enum class PaletteId : uint8_t
+{
+    Rainbow,   // Orange-yellow through the hue circle, used by the default effect
+    Christmas, // Red / green
+    Barbie,    // Purple / pink
+    Usa,       // Red / white
+    Count
+};
+
+/*
+    Palettes are compiled once into 256-entry RGB lookup tables, so rendering a
+    pixel is a table lookup plus a brightness scale instead of an HSV conversion.
+    Two-tone palettes hold the first color in entries 0..127 and the second in
+    128..255.
+*/
+void compilePalette(PaletteId id, CRGBPalette256 &lut);
+
+const char *paletteName(PaletteId id);
+
+// Brightness-scaled lookup kernel
+inline CRGB paletteLookup(const CRGBPalette256 &lut, uint8_t index, uint8_t brightness)
+{
+    const CRGB &color = lut[index];
+
+    return CRGB(scale8(color.r, brightness), scale8(color.g, brightness), scale8(color.b, brightness));
+}
+
+#endif
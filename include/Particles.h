@@ -0,0 +1,66 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <Arduino.h>
+#include <FastLED.h>
+#include "PowerLimiter.h"
+
+/* xorshift32 generator, a few cycles per number and no global state */
+class FastRandom
+{
+private:
+    uint32_t state_;
+
+public:
+    explicit FastRandom(uint32_t seed = 0x9E3779B9) : state_(seed ? seed : 1) {}
+
+    void seed(uint32_t seed) { state_ = seed ? seed : 1; }
+
+    uint32_t next()
+    {
+        uint32_t x = state_;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return state_ = x;
+    }
+
+    // Uniform value in 0..limit-1, using multiply-shift instead of a division
+    uint16_t below(uint16_t limit) { return ((next() >> 16) * limit) >> 16; }
+};
+
+/*
+    Fixed-capacity particle pool stored as struct of arrays. Live particles are
+    kept in the range 0..count-1; an expired particle is replaced by the last
+    one, so neither spawning nor culling needs a search or the heap.
+*/
+class ParticleSystem
+{
+public:
+    static const uint16_t kCapacity = 256;
+
+private:
+    int32_t position_[kCapacity]; // LED index in 8.8 fixed point
+    int16_t velocity_[kCapacity]; // LEDs per frame in 8.8 fixed point
+    uint8_t life_[kCapacity];     // Remaining life, doubles as brightness
+    uint8_t decay_[kCapacity];    // Life lost per frame
+    uint16_t count_ = 0;
+
+public:
+    bool spawn(int32_t position, int16_t velocity, uint8_t life, uint8_t decay);
+    void clear() { count_ = 0; }
+
+    // Move, age and draw all particles in a single pass over the pool
+    void updateAndRender(CRGB *leds, uint16_t numLeds, PowerMeter &power);
+
+    uint16_t count() const { return count_; }
+};
+
+/*
+    Benchmark load: keeps the pool full of moving particles on a strip of
+    'numLeds' for 'frames' frames, respawning the culled ones as the emitters
+    do. Returns the number of particle updates; the caller takes the time.
+*/
+uint32_t runParticleBenchmark(ParticleSystem &particles, CRGB *leds, uint16_t numLeds, uint16_t frames);
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef POWERLIMITER_H
+#define POWERLIMITER_H
+
+#include <Arduino.h>
+#include <FastLED.h>
+
+/* ----- LED power model, same constants as FastLED's power management ----- */
+const uint8_t kLedRedMilliamps = 16;   // Per channel at full value, 5 V
+const uint8_t kLedGreenMilliamps = 11;
+const uint8_t kLedBlueMilliamps = 15;
+const uint8_t kLedDarkMilliamps = 1;   // Each LED, also when off
+const uint8_t kLedVolts = 5;
+
+// Current drawn by a pixel in 1/255 mA
+inline uint16_t pixelLoad(const CRGB &c)
+{
+    return c.r * kLedRedMilliamps + c.g * kLedGreenMilliamps + c.b * kLedBlueMilliamps;
+}
+
+/*
+    Sum of the load of all pixels of a frame, maintained by the effects while
+    they write the pixels, so no extra pass over the strip is needed.
+
+    The effects write values before the gamma correction of the output pass.
+    With the output levels of OutputCorrection set, each channel is counted
+    at the level the LED is driven with, otherwise the values are taken as
+    linear.
+*/
+class PowerMeter
+{
+private:
+    uint32_t load_ = 0;
+    const uint16_t *levels_[3] = {nullptr, nullptr, nullptr}; // Output level per channel value, 8.8 fixed point
+
+    uint16_t outputLoad(const CRGB &c) const
+    {
+        if (levels_[0] == nullptr)
+            return pixelLoad(c);
+
+        return (levels_[0][c.r] * kLedRedMilliamps + levels_[1][c.g] * kLedGreenMilliamps +
+                levels_[2][c.b] * kLedBlueMilliamps + 0x80) >> 8;
+    }
+
+public:
+    // Tables of OutputCorrection::levels(), they are read while counting and may change in place
+    void setLevels(const uint16_t *red, const uint16_t *green, const uint16_t *blue)
+    {
+        levels_[0] = red;
+        levels_[1] = green;
+        levels_[2] = blue;
+    }
+
+    void reset(uint32_t load = 0) { load_ = load; }
+
+    void add(const CRGB &c) { load_ += outputLoad(c); }
+    void add(const CRGB &c, uint16_t count) { load_ += (uint32_t)outputLoad(c) * count; }
+
+    // A pixel that was already counted is overwritten
+    void replace(const CRGB &before, const CRGB &after) { load_ += outputLoad(after) - outputLoad(before); }
+
+    uint32_t load() const { return load_; }
+};
+
+/*
+    Scales the global brightness so the estimated draw stays within the budget.
+    Brightness drops at once (attack) and recovers slowly (release), so beat
+    flashes do not make the strip pump. The model can optionally be calibrated with the measured
+    current, if the strip is powered through the measured supply.
+*/
+class PowerLimiter
+{
+private:
+    uint32_t budgetMilliwatts_ = 0;
+    uint16_t numLeds_ = 0;
+
+    float scale_ = 255.0f;       // Applied brightness
+    float calibration_ = 1.0f;   // Measured / modelled LED draw
+    float baselineMilliwatts_ = 0.0f; // Measured draw with all LEDs dark
+    float ledMilliwatts_ = 0.0f; // Uncalibrated LED draw of the last frame at the applied brightness
+
+public:
+    uint8_t masterBrightness = 255;
+    float attack = 1.0f;   // Share of the gap closed per frame when dimming, below 1 the budget may be exceeded briefly
+    float release = 0.05f; // Share of the gap closed per frame when brightening
+
+    void begin(uint8_t volts, uint32_t milliamps, uint16_t numLeds);
+
+    // Brightness for the frame with the given load, scaled in by OutputCorrection::apply()
+    uint8_t update(uint32_t load);
+
+    // Feed a current reading [mA] of the supply at kLedVolts
+    void addMeasurement(float milliamps);
+
+    uint8_t brightness() const { return scale_ + 0.5f; }
+    float calibration() const { return calibration_; }
+    uint32_t estimatedMilliwatts() const;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef PRESETRECORD_H
+#define PRESETRECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+const uint8_t kPresetNameLength = 16;
+const uint8_t kPresetBandCount = 64;
+const uint8_t kPresetMaxCount = 8;
+
+/*
+    Everything needed to restore a show. The layout is fixed (no padding, little
+    endian) because presets are stored as a binary blob and sent over BLE as is.
+*/
+struct Preset
+{
+    char name[kPresetNameLength]; // Zero terminated
+    float bandGain[kPresetBandCount];
+    float beatThreshold;
+    float sensitivityMax;
+    uint8_t effect;    // EffectId
+    uint8_t palette;   // PaletteId
+    uint8_t modifiers; // Bit mask indexed by ModifierId
+    uint8_t brightness;
+    uint8_t bassHue;
+    uint8_t colorStep;
+    uint8_t solidHue;
+    uint8_t solidSaturation;
+    uint8_t solidBrightness;
+    uint8_t followPitch;    // Band colors follow the dominant pitch class, zero in presets saved before
+    uint8_t dynamicEffects; // Bit mask indexed by EffectId, effects with VU dynamics
+    uint8_t vuRelease;      // Zero in presets saved before, keeps the current release
+    uint8_t fftSizeLog2;    // Block size as log2 of the sample count, 0 keeps the current size
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(Preset) == 296, "Preset layout changed, increase kPresetRecordVersion");
+
+const uint32_t kPresetRecordMagic = 0x50564141; // "AAVP"
+const uint16_t kPresetRecordVersion = 3;
+
+/*
+    One stored set of presets. Two records are kept and written alternately;
+    the valid one with the higher sequence number is loaded, so a record that
+    is damaged after it was written falls back to the one before it.
+*/
+struct PresetRecord
+{
+    uint32_t magic;
+    uint16_t version;
+    uint8_t count;
+    uint8_t active;
+    uint32_t sequence;
+    Preset presets[kPresetMaxCount];
+    uint16_t crc; // CRC-16/CCITT-FALSE over all preceding fields
+};
+
+enum class PresetRecordStatus : uint8_t
+{
+    Valid,
+    Missing,  // No record or a truncated one
+    Outdated, // Another magic or version
+    Corrupt   // Bad CRC or values out of range
+};
+
+// True if all gains are finite and not negative
+bool areBandGainsValid(const float *gain, uint8_t count);
+
+// True if the preset holds valid band gains, finite numbers and a positive sensitivity limit
+bool isPresetValid(const Preset &preset);
+
+// Set magic, version and CRC before the record is written
+void sealPresetRecord(PresetRecord &record);
+
+// Check a record of which 'length' bytes could be read
+PresetRecordStatus checkPresetRecord(const PresetRecord &record, size_t length);
+
+// Index of the newest valid record of two slots, or -1 if neither is valid
+int8_t newestPresetRecord(const PresetRecordStatus status[2], const PresetRecord record[2]);
+
+#endif
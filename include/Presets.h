@@ -0,0 +1,46 @@
+#ifndef PRESETS_H
+#define PRESETS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "PresetRecord.h"
+
+/*
+    Versioned, CRC protected set of presets, kept in two NVS records that are
+    written alternately (see PresetRecord.h). If neither record is usable the
+    built-in defaults are loaded, so a bad write never prevents booting.
+*/
+class PresetStore
+{
+public:
+    static const uint8_t kMaxPresets = kPresetMaxCount;
+
+private:
+    PresetRecord record_;
+    uint8_t slot_ = 1; // Slot of the last record read or written, the next save goes to the other
+
+    PresetRecordStatus readSlot(uint8_t slot, PresetRecord &record);
+    bool writeSlot(uint8_t slot, const PresetRecord &record);
+
+public:
+    // Load the store; falls back to defaults derived from 'live' and returns false if that was needed
+    bool load(const Preset &live);
+    bool save();
+
+    void loadDefaults(const Preset &live);
+
+    uint8_t count() const { return record_.count; }
+    uint8_t activeIndex() const { return record_.active; }
+    const Preset &preset(uint8_t idx) const { return record_.presets[idx]; }
+    const Preset &activePreset() const { return record_.presets[record_.active]; }
+
+    bool select(uint8_t idx);
+    bool setPreset(uint8_t idx, const Preset &preset);
+
+    // Text list of all presets, the active one is marked with '*'
+    size_t format(char *buffer, size_t size) const;
+};
+
+extern PresetStore presetStore;
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef SAMPLECONDITIONING_H
+#define SAMPLECONDITIONING_H
+
+#include <stdint.h>
+
+// Level statistics of the raw samples of one analysis block
+struct BlockStats
+{
+    int32_t sum = 0;         // For the DC offset of the next block
+    uint64_t sumSquares = 0; // DC free, for the RMS
+    uint16_t peak = 0;       // DC free magnitude
+};
+
+/*
+    Convert 'count' raw samples to FFT input in a single pass and add them to
+    'stats'. The DC offset is estimated from the previous block, so a DMA buffer
+    can be converted as soon as it has arrived.
+
+    'raw' may alias 'real' as long as real[i] never overlaps an unread raw[j],
+    j > i, see the analysis arena in FFTProcessor.cpp.
+*/
+void conditionSamples(const int16_t *raw, float *real, float *imag, uint16_t count,
+                      int16_t dcOffset, float scale, BlockStats &stats);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef SHOWFORMAT_H
+#define SHOWFORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+    Recorded light show: the band lightness and beat of every analysed frame,
+    replayed through the live effects. All fields little endian.
+
+    File header:
+    offset  size  field
+    0       4     magic "LSHW"
+    4       1     version (kShowVersion)
+    5       1     band count N
+    6       2     keyframe interval K [frames]
+
+    Followed by one record per frame:
+    0       1     flags (bit 7: keyframe, bit 6: beat)
+    1       1..4  time since the previous frame [100 us], unsigned LEB128
+    Keyframe:     N lightness bytes
+    Delta frame:  N/8 bytes change mask, bit b of byte b/8 set if band b changed,
+                  then one code per changed band in 4-bit nibbles, high nibble first:
+                  1..15 = zigzag coded change, 0 = escape followed by 3 nibbles
+                  holding the zigzag coded change; padded to a whole byte
+
+    Every K-th frame is a keyframe, so a wrong lightness value carries over at
+    most to the next keyframe. Records have no sync word, length or CRC: damage
+    to flags, times or a change mask shifts every record boundary after it, and
+    ShowPlayer ends the playback at the first record it detects as corrupt.
+    tools/show_tool.py writes and reads the same format.
+*/
+const uint8_t kShowMagic[4] = {'L', 'S', 'H', 'W'};
+const uint8_t kShowVersion = 1;
+const uint8_t kShowHeaderSize = 8;
+const uint8_t kShowBandCount = 64;
+const uint16_t kShowKeyframeInterval = 32;
+const uint8_t kShowFlagKeyframe = 0x80;
+const uint8_t kShowFlagBeat = 0x40;
+const uint16_t kShowMaxRecordSize = 1 + 4 + kShowBandCount / 8 + 2 * kShowBandCount;
+
+struct ShowFrame
+{
+    uint32_t timeMicros; // Since the start of the show
+    bool isBeat;
+    uint8_t lightness[kShowBandCount];
+};
+
+class ShowEncoder
+{
+private:
+    uint8_t previous_[kShowBandCount] = {0};
+    uint32_t encodedMicros_ = 0; // Time of the previous record as the decoder sees it
+    uint16_t sinceKeyframe_ = 0;
+    bool isStarted_ = false;
+
+public:
+    // Write the file header and restart the delta coding, returns the size or 0 if it does not fit
+    size_t begin(uint8_t *buffer, size_t size);
+
+    // Append a record, returns its size or 0 if it does not fit
+    size_t encode(const ShowFrame &frame, uint8_t *buffer, size_t size);
+};
+
+class ShowDecoder
+{
+private:
+    uint8_t previous_[kShowBandCount] = {0};
+    uint32_t timeMicros_ = 0;
+    uint16_t keyframeInterval_ = 0;
+    bool hasKeyframe_ = false;
+
+public:
+    bool isCorrupt = false;
+
+    // Check the file header, returns its size or 0 if incomplete or invalid
+    size_t begin(const uint8_t *buffer, size_t length);
+
+    // Decode the next record, returns its size or 0 if it is incomplete or corrupt (see isCorrupt)
+    size_t decode(const uint8_t *buffer, size_t length, ShowFrame &frame);
+
+    uint16_t keyframeInterval() const { return keyframeInterval_; }
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef SHOWPLAYER_H
+#define SHOWPLAYER_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/stream_buffer.h>
+#include "AnalysisFrame.h"
+#include "ShowFormat.h"
+
+/*
+    Plays a recorded show from LittleFS in place of the live analysis. The file
+    is read in chunks of kChunkSize bytes and decoded a few frames ahead, so a
+    show of any length needs about 1.2 kB of RAM.
+
+    Playback follows the recorded time, locked to the live beat: a live beat
+    shortly before a recorded one makes the show jump ahead to it, and a
+    recorded beat that arrives before the live one holds the show until the
+    live beat comes. Either correction is limited to kSyncWindowMicros and only
+    made while live beats are being detected.
+*/
+class ShowPlayer
+{
+public:
+    static const uint16_t kChunkSize = 512;
+    static const uint8_t kLookahead = 8;               // Decoded frames, about 370 ms at 2048 samples per frame
+    static const uint32_t kSyncWindowMicros = 150000;  // Largest correction per beat
+    static const uint32_t kBeatLockMicros = 2000000;   // Sync is off if the last live beat is older
+    static const uint32_t kMaxStepMicros = 200000;     // Longer gaps, e.g. idle mode, pause the show
+
+private:
+    File file_;
+    ShowDecoder decoder_;
+    uint8_t chunk_[kChunkSize];
+    uint16_t chunkPos_ = 0;
+    uint16_t chunkEnd_ = 0;
+    bool isEndOfFile_ = false;
+
+    // Decoded frames not yet shown
+    ShowFrame queue_[kLookahead];
+    uint8_t queueHead_ = 0;
+    uint8_t queueCount_ = 0;
+
+    AnalysisFrame frame_ = {};
+    bool isPlaying_ = false;
+
+    uint32_t positionMicros_ = 0; // Show time
+    uint32_t lastUpdateMicros_ = 0;
+    uint32_t liveBeatMicros_ = 0;
+    uint32_t holdStartMicros_ = 0;
+    bool isHolding_ = false;
+
+    uint32_t syncJumps_ = 0;
+    uint32_t syncHolds_ = 0;
+
+    bool readChunk();
+    bool fillQueue();
+
+public:
+    bool play(const char *path);
+    void stop();
+    bool isPlaying() const { return isPlaying_; }
+
+    // Advance the show to 'nowMicros', returns the frame to show or nullptr once it has ended
+    const AnalysisFrame *update(uint32_t nowMicros, bool isLiveBeat);
+
+    uint32_t syncJumps() const { return syncJumps_; }
+    uint32_t syncHolds() const { return syncHolds_; }
+};
+
+/*
+    Records the live analysis into a show file. Records are encoded on the
+    analysis task and queued in a stream buffer; a background task writes them
+    to LittleFS, so the analysis never waits for the file system. A frame that
+    does not fit the buffer is skipped before encoding, so the delta coding
+    stays intact and the decoder sees a longer frame interval.
+*/
+class ShowRecorder
+{
+private:
+    StreamBufferHandle_t buffer_ = nullptr;
+    File file_;
+    ShowEncoder encoder_;
+    bool isRecording_ = false;
+    volatile bool isClosing_ = false; // Set when stopped, cleared by the writer once the file is closed
+
+    uint32_t frames_ = 0;
+    uint32_t bytes_ = 0;
+    uint32_t droppedFrames_ = 0;
+
+    static void writerTask(void *param);
+
+public:
+    bool begin(size_t bufferSize = 4096);
+
+    bool record(const char *path);
+    void add(const AnalysisFrame &frame);
+    void stop();
+    bool isRecording() const { return isRecording_; }
+
+    uint32_t frames() const { return frames_; }
+    uint32_t bytes() const { return bytes_; }
+    uint32_t droppedFrames() const { return droppedFrames_; }
+};
+
+// Encode and decode synthetic frames in RAM and print throughput and compression ratio
+void printShowBenchmark();
+
+extern ShowPlayer showPlayer;
+extern ShowRecorder showRecorder;
+
+#endif
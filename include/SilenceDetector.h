@@ -0,0 +1,39 @@
+#ifndef SILENCEDETECTOR_H
+#define SILENCEDETECTOR_H
+
+#include <stdint.h>
+
+/*
+    Decides from the RMS of each sample block whether the room is silent.
+
+    The noise floor follows the quietest blocks: it drops immediately to a
+    lower RMS and rises slowly otherwise, at the same rate per second whatever
+    the size of the blocks it is fed. A block counts as quiet when its RMS
+    is below the floor times 'marginFactor' and below 'maxSilenceRms'. Silence
+    starts after 'holdMillis' of quiet blocks and ends with the first loud one.
+*/
+class SilenceDetector
+{
+private:
+    float noiseFloor_ = 0.0f;
+    uint32_t quietSinceMillis_ = 0;
+    bool isQuiet_ = false;
+    bool isSilent_ = false;
+
+public:
+    float marginFactor = 2.0f;    // 6 dB above the noise floor
+    float maxSilenceRms = 200.0f; // Absolute limit in raw sample units (about -44 dBFS)
+    float floorRise = 1.0005f;    // Noise floor increase per kFloorRiseSamples samples
+    uint32_t holdMillis = 5000;
+
+    static const uint16_t kFloorRiseSamples = 2048;
+
+    // Feed the RMS of a block of 'sampleCount' samples, returns true while silent
+    bool update(float rms, uint16_t sampleCount, uint32_t nowMillis);
+
+    bool isSilent() const { return isSilent_; }
+    float noiseFloor() const { return noiseFloor_; }
+    float threshold() const;
+};
+
+#endif
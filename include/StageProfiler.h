@@ -0,0 +1,123 @@
+#ifndef STAGEPROFILER_H
+#define STAGEPROFILER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+enum class Stage : uint8_t
+{
+    I2SWait, // Time blocked waiting for DMA buffers, i.e. idle time of the analysis task
+    Conditioning,
+    FFT,
+    Spectrum,
+    Bands,
+    Beat,
+    Effects,
+    Output, // Gamma, brightness and dithering of the frame sent to the LEDs
+    LedShow,
+    Frame, // Processing of one block, from the end of the I2S wait to the LED update
+    Count
+};
+
+/*
+    Log-linear latency histogram: exact below 4 us, then 4 buckets per power of
+    two up to about one second. Percentiles are reported as bucket upper bounds,
+    i.e. with at most 25 % overestimation.
+*/
+class LatencyHistogram
+{
+public:
+    static const uint8_t kBucketCount = 80;
+
+private:
+    uint32_t buckets_[kBucketCount] = {0};
+    uint32_t count_ = 0;
+    uint32_t max_ = 0;
+    uint32_t last_ = 0;
+
+    static uint8_t bucketIndex(uint32_t micros);
+    static uint32_t bucketUpperBound(uint8_t idx);
+
+public:
+    void record(uint32_t micros);
+    void reset();
+
+    uint32_t count() const { return count_; }
+    uint32_t max() const { return max_; }
+    uint32_t last() const { return last_; }
+    uint32_t percentile(uint8_t percent) const;
+};
+
+/*
+    Per-stage latency probes. Timestamps come from the CPU cycle counter on the
+    target and from std::chrono on the host, so a probe costs a few cycles.
+
+    Usage:
+        uint32_t t = stageProfiler.now();
+        ... stage work ...
+        t = stageProfiler.record(Stage::FFT, t);
+
+    Every stage has a budget declared as a share of the frame budget, see
+    kStageBudgetPercent. Frames in which a stage exceeds it are counted as
+    overruns of that stage; an overrun of Stage::Frame is a deadline miss.
+*/
+class StageProfiler
+{
+private:
+    LatencyHistogram histograms_[(uint8_t)Stage::Count];
+    uint32_t overruns_[(uint8_t)Stage::Count] = {0};
+    uint32_t budgetMicros_[(uint8_t)Stage::Count] = {0}; // Zero for stages without a budget
+    uint32_t droppedFrames_ = 0;
+    uint32_t frameBudgetMicros_ = 0;
+    uint32_t cyclesPerMicro_ = 240;
+    uint32_t frameStart_ = 0;
+
+public:
+    static const char *stageName(Stage stage);
+
+    void setFrameBudget(uint32_t micros);
+    void setCpuFrequency(uint32_t mhz) { cyclesPerMicro_ = mhz ? mhz : 1; }
+    uint32_t frameBudget() const { return frameBudgetMicros_; }
+
+    uint32_t now() const
+    {
+#ifdef ARDUINO
+        return ESP.getCycleCount();
+#else
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+#endif
+    }
+
+    // Record the time since 'start', plus 'earlierTicks' spent on the stage before, and return the current timestamp
+    uint32_t record(Stage stage, uint32_t start, uint32_t earlierTicks = 0);
+    void recordTicks(Stage stage, uint32_t ticks); // Duration in now() units
+    void recordMicros(Stage stage, uint32_t micros);
+
+    void beginFrame() { frameStart_ = now(); }
+    void endFrame() { record(Stage::Frame, frameStart_); }
+
+    void countDroppedFrame() { droppedFrames_++; }
+
+    const LatencyHistogram &histogram(Stage stage) const { return histograms_[(uint8_t)stage]; }
+    uint32_t droppedFrames() const { return droppedFrames_; }
+    uint32_t deadlineMisses() const { return overruns_[(uint8_t)Stage::Frame]; }
+    uint32_t overruns(Stage stage) const { return overruns_[(uint8_t)stage]; }
+    uint32_t stageBudget(Stage stage) const { return budgetMicros_[(uint8_t)stage]; }
+
+    void reset();
+
+    // Text report with p50/p95/p99/max, budget and overruns per stage, returns the number of characters written
+    size_t format(char *buffer, size_t size) const;
+};
+
+extern StageProfiler stageProfiler;
+
+#endif
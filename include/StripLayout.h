@@ -0,0 +1,77 @@
+#ifndef STRIPLAYOUT_H
+#define STRIPLAYOUT_H
+
+#include <Arduino.h>
+
+enum class LedRole : uint8_t
+{
+    Bass,   // Beat indicator at both ends of the strip
+    Band,   // Frequency band, mirrored around the center of the strip
+    Center  // Odd LED left over in the middle of the strip
+};
+
+struct LedMapEntry
+{
+    LedRole role;
+    uint8_t band;    // Lower one of the two frequency bands the LED is interpolated from
+    uint8_t weight;  // Interpolation weight of the upper band (0 = lower band only)
+    uint8_t hue;     // Position within the frequency section, 0 at the bass end and 255 at the center
+    uint16_t mirror; // Index of the LED at the same position on the other half of the strip
+};
+
+/*
+    Compiles the assignment of LEDs to the bass indicator and the frequency bands
+    once at setup, for any strip length and band count. Both halves of the strip
+    are mirrored around the center, so effects only need to evaluate the first
+    half and copy each value to 'mirror'. The table lives in caller-provided
+    storage so that several segments can share one pool.
+*/
+class StripLayout
+{
+public:
+    static const uint16_t kMaxLeds = 600;
+    static const uint8_t kDefaultBassShare = 18; // Share of each half used for the bass indicator, in 1/256
+
+private:
+    LedMapEntry *entries_ = nullptr;
+    uint16_t numLeds_ = 0;
+    uint8_t bandCount_ = 0;
+    uint16_t bassLeds_ = 0;
+
+public:
+    bool build(LedMapEntry *entries, uint16_t numLeds, uint8_t bandCount, bool reversed = false,
+               uint8_t bassShare = kDefaultBassShare);
+
+    uint16_t size() const { return numLeds_; }
+    uint16_t halfSize() const { return (numLeds_ + 1) / 2; }
+    uint8_t bandCount() const { return bandCount_; }
+    uint16_t bassLeds() const { return bassLeds_; }
+
+    const LedMapEntry &operator[](uint16_t ledIdx) const { return entries_[ledIdx]; }
+
+    // Lightness of the LED, linearly interpolated between its two bands
+    static uint8_t level(const LedMapEntry &entry, const uint8_t *lightness)
+    {
+        int lower = lightness[entry.band];
+
+        if (entry.weight == 0)
+            return lower;
+
+        return lower + (((lightness[entry.band + 1] - lower) * entry.weight) >> 8);
+    }
+
+    // As above, with the peak-hold marker shown as an afterglow at a quarter of its level
+    static uint8_t level(const LedMapEntry &entry, const uint8_t *lightness, const uint8_t *peaks)
+    {
+        uint8_t value = level(entry, lightness);
+
+        if (peaks == nullptr)
+            return value;
+
+        uint8_t marker = level(entry, peaks) >> 2;
+
+        return (marker > value) ? marker : value;
+    }
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include "Crc16.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/stream_buffer.h>
+
+/*
+    Binary telemetry frame, all fields little endian:
+
+    offset  size  field
+    0       2     sync word 0xA5 0x5A
+    2       1     frame type (kTelemetryTypeAnalysis)
+    3       1     payload length P
+    4       2     sequence number
+    6       4     timestamp [us]
+    10      4     sensitivity factor (float)
+    14      4     magnitude sum (float)
+    18      1     flags (bit 0: beat hit)
+    19      1     band count N
+    20      N     band lightness (0..255)
+    20+N    1     stage count S
+    21+N    2*S   last stage durations [us], saturated at 65535
+    4+P     2     CRC-16/CCITT-FALSE over type, length and payload
+
+    Band gain frame, same framing with type kTelemetryTypeGains. Sent when the
+    band table changes and every few seconds, so a capture started later has the
+    gains as well; they apply from the analysis frame with the given sequence:
+
+    offset  size  field
+    4       2     sequence number of the next analysis frame
+    6       1     band count N
+    7       2*N   band gains in 1/256 (8.8 fixed point), saturated at 65535
+
+    The decoder in tools/telemetry_decode.py resynchronizes on the sync word and
+    drops frames with a bad CRC, so the stream may share the port with log text.
+*/
+const uint8_t kTelemetrySync0 = 0xA5;
+const uint8_t kTelemetrySync1 = 0x5A;
+const uint8_t kTelemetryTypeAnalysis = 1;
+const uint8_t kTelemetryTypeGains = 3; // 2 is the raw audio frame, see AudioCapture.h
+const uint8_t kTelemetryMaxBands = 64;
+const uint16_t kTelemetryMaxFrameSize = 4 + 255 + 2;
+
+struct TelemetryFrame
+{
+    uint32_t timestamp;
+    float sensitivity;
+    float magnitudeSum;
+    bool isBeatHit;
+    uint8_t bandCount;
+    const uint8_t *lightness;
+    uint8_t stageCount;
+    const uint32_t *stageMicros;
+};
+
+// Encode a frame into 'buffer', returns the frame size or 0 if it does not fit
+size_t encodeTelemetryFrame(uint8_t *buffer, size_t size, uint16_t sequence, const TelemetryFrame &frame);
+
+// Encode a band gain frame into 'buffer', returns the frame size or 0 if it does not fit
+size_t encodeTelemetryGains(uint8_t *buffer, size_t size, uint16_t sequence, const float *gain, uint8_t bandCount);
+
+/*
+    Frames are encoded on the analysis task and queued in a stream buffer; a
+    background task on the other core writes them to the serial port. If the
+    buffer is full the frame is dropped instead of blocking the analysis.
+*/
+class Telemetry
+{
+private:
+    StreamBufferHandle_t buffer_ = nullptr;
+    bool isEnabled_ = false;
+    uint16_t sequence_ = 0;
+    uint32_t droppedFrames_ = 0;
+
+    static void writerTask(void *param);
+
+public:
+    bool begin(size_t bufferSize = 4096);
+
+    void setEnabled(bool enabled) { isEnabled_ = enabled && buffer_ != nullptr; }
+    bool isEnabled() const { return isEnabled_; }
+
+    // True while the serial port carries binary frames, text output would corrupt them
+    bool isStreaming() const
+    {
+#ifdef AUDIOVIS_RAW_CAPTURE
+        return buffer_ != nullptr;
+#else
+        return isEnabled_;
+#endif
+    }
+
+    void publish(const TelemetryFrame &frame);
+
+    // Band gains of the frames that follow, does not take a sequence number of its own
+    void publishGains(const float *gain, uint8_t bandCount);
+
+    // Queue an already encoded frame, returns false (and counts a drop) if it does not fit
+    bool send(const uint8_t *data, size_t length);
+
+    uint32_t droppedFrames() const { return droppedFrames_; }
+};
+
+extern Telemetry telemetry;
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef VUDYNAMICS_H
+#define VUDYNAMICS_H
+
+#include <Arduino.h>
+
+/*
+    VU meter ballistics for the band lightness: fast attack, adjustable
+    release and a peak marker per band that is held for a while and then
+    falls with constant acceleration. Levels are kept in 8.8 fixed point, so
+    a frame costs a few integer operations per band and no float work.
+*/
+class VuDynamics
+{
+public:
+    static const uint8_t kBandCount = 64;
+
+private:
+    uint16_t level_[kBandCount] = {0};    // 8.8 fixed point
+    uint16_t peak_[kBandCount] = {0};     // 8.8 fixed point
+    uint16_t velocity_[kBandCount] = {0}; // Fall speed of the peak, 8.8 per frame
+    uint8_t hold_[kBandCount] = {0};      // Frames left before the peak starts to fall
+    uint8_t levelOut_[kBandCount] = {0};
+    uint8_t peakOut_[kBandCount] = {0};
+
+public:
+    uint8_t attack = 255;    // Share of a rise applied per frame, in 1/256 (255 = instant)
+    uint8_t release = 24;    // Share of a fall applied per frame, in 1/256
+    uint8_t holdFrames = 20; // About 0.9 s at 2048 samples per frame
+    uint8_t gravity = 160;   // Peak acceleration, 8.8 per frame squared; a full peak falls in about a second
+
+    void process(const uint8_t *lightness);
+    void reset();
+
+    const uint8_t *levels() const { return levelOut_; }
+    const uint8_t *peaks() const { return peakOut_; }
+};
+
+#endif
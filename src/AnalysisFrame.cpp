@@ -0,0 +1,38 @@
+#include "AnalysisFrame.h"
+
+const float SpectrumFeatures::kRolloffShare = 0.85f;
+const float SpectrumFeatures::kMagnitudeFloor = 1e-3f;
+
+void SpectrumFeatures::begin()
+{
+    sum_ = 0.0f;
+    weightedSum_ = 0.0f;
+    fluxSum_ = 0.0f;
+    logSum_ = 0.0f;
+    binIdx_ = 0.0f;
+    rolloffBins_ = 0;
+}
+
+void SpectrumFeatures::finish(AnalysisFrame &frame, float freqStep)
+{
+    if (binIdx_ == 0.0f || sum_ <= 0.0f)
+    {
+        frame.centroidHz = 0.0f;
+        frame.rolloffHz = 0.0f;
+        frame.flux = 0.0f;
+        frame.flatness = 0.0f;
+        frame.magnitudeSum = 0.0f;
+        rolloffThreshold_ = 0.0f;
+        return;
+    }
+
+    float mean = sum_ / binIdx_;
+
+    frame.centroidHz = weightedSum_ / sum_ * freqStep;
+    frame.rolloffHz = rolloffBins_ * freqStep;
+    frame.flux = fluxSum_ / sum_;
+    frame.flatness = min(exp2f(logSum_ / binIdx_) / mean, 1.0f);
+    frame.magnitudeSum = sum_;
+
+    rolloffThreshold_ = kRolloffShare * sum_;
+}
@@ -0,0 +1,181 @@
+#include "AudioCapture.h"
+#include "Telemetry.h"
+
+#ifdef AUDIOVIS_RAW_CAPTURE
+AudioCapture audioCapture;
+#endif
+
+/* MSB-first bit packer with a hard end, sets 'overflow' instead of writing past it */
+class BitWriter
+{
+private:
+    uint8_t *pos_;
+    uint8_t *end_;
+    uint32_t acc_ = 0;
+    uint8_t bits_ = 0;
+
+public:
+    bool overflow = false;
+
+    BitWriter(uint8_t *begin, uint8_t *end) : pos_(begin), end_(end) {}
+
+    void write(uint32_t value, uint8_t count)
+    {
+        // Split long values so the accumulator never holds more than 31 bits
+        if (count > 16)
+        {
+            write(value >> 16, count - 16);
+            count = 16;
+        }
+
+        acc_ = (acc_ << count) | (value & ((1u << count) - 1));
+        bits_ += count;
+
+        while (bits_ >= 8)
+        {
+            if (pos_ == end_)
+            {
+                overflow = true;
+                bits_ = 0;
+                return;
+            }
+
+            bits_ -= 8;
+            *pos_++ = acc_ >> bits_;
+        }
+    }
+
+    void writeOnes(uint8_t count)
+    {
+        while (count > 16)
+        {
+            write(0xFFFF, 16);
+            count -= 16;
+        }
+
+        write(0xFFFF, count);
+    }
+
+    uint8_t *flush()
+    {
+        if (bits_ > 0)
+        {
+            write(0, 8 - bits_);
+        }
+
+        return pos_;
+    }
+};
+
+static inline uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static uint8_t *putU16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *putU32(uint8_t *p, uint32_t v)
+{
+    p = putU16(p, v & 0xFFFF);
+    return putU16(p, v >> 16);
+}
+
+size_t encodeAudioBlock(uint8_t *buffer, size_t size, uint32_t sequence, uint32_t timestamp,
+                        const int16_t *samples, uint16_t count)
+{
+    if (count == 0 || size < audioFrameMaxSize(count))
+        return 0;
+
+    // Choose the Rice parameter from the mean magnitude of the deltas
+    uint32_t deltaSum = 0;
+
+    for (uint16_t i = 1; i < count; i++)
+    {
+        deltaSum += zigzag(samples[i] - samples[i - 1]);
+    }
+
+    uint32_t deltaMean = deltaSum / count;
+    uint8_t k = 0;
+
+    while (k < 15 && (2u << k) <= deltaMean)
+    {
+        k++;
+    }
+
+    // Rice coded deltas, limited to the size of the verbatim encoding
+    uint8_t *data = buffer + kAudioHeaderSize;
+    uint8_t *dataEnd = data + 2 * (count - 1);
+
+    AudioCoding coding = AudioCoding::Rice;
+    BitWriter writer(data, dataEnd);
+
+    for (uint16_t i = 1; i < count && !writer.overflow; i++)
+    {
+        uint32_t u = zigzag(samples[i] - samples[i - 1]);
+        uint32_t q = u >> k;
+
+        if (q < kRiceEscapeLength)
+        {
+            writer.writeOnes(q);
+            writer.write(0, 1);
+            writer.write(u, k);
+        }
+        else
+        {
+            writer.writeOnes(kRiceEscapeLength);
+            writer.write(u, 17);
+        }
+    }
+
+    uint8_t *p = writer.flush();
+
+    if (writer.overflow)
+    {
+        // Incompressible block, e.g. clipping noise
+        coding = AudioCoding::Verbatim;
+        p = data;
+
+        for (uint16_t i = 1; i < count; i++)
+        {
+            p = putU16(p, samples[i]);
+        }
+    }
+
+    uint16_t payloadLength = p - (buffer + 5);
+
+    uint8_t *h = buffer;
+    *h++ = kAudioSync0;
+    *h++ = kAudioSync1;
+    *h++ = kAudioTypeBlock;
+    h = putU16(h, payloadLength);
+    h = putU32(h, sequence);
+    h = putU32(h, timestamp);
+    h = putU16(h, count);
+    *h++ = (uint8_t)coding;
+    *h++ = k;
+    putU16(h, samples[0]);
+
+    // The CRC covers everything after the sync word
+    p = putU16(p, crc16Ccitt(buffer + 2, p - buffer - 2));
+
+    return p - buffer;
+}
+
+void AudioCapture::capture(const int16_t *samples, uint16_t count, uint32_t timestamp)
+{
+    if (count > kMaxBlockSamples)
+        count = kMaxBlockSamples;
+
+    size_t length = encodeAudioBlock(frame_, sizeof(frame_), sequence_++, timestamp, samples, count);
+
+    rawBytes_ += 2 * count;
+    encodedBytes_ += length;
+
+    // A dropped block shows up as a sequence gap in the recording
+    telemetry.send(frame_, length);
+}
@@ -0,0 +1,237 @@
+#include "BandTable.h"
+#include "PresetRecord.h"
+
+bool BandTables::begin(float startHz, float freqStep, uint16_t binCount)
+{
+    startHz_ = startHz;
+    freqStep_ = freqStep;
+    binCount_ = binCount;
+
+    writerMutex_ = xSemaphoreCreateMutex();
+
+    if (writerMutex_ == nullptr)
+    {
+        log_e("Failed to create band table mutex.");
+        return false;
+    }
+
+    return true;
+}
+
+bool BandTables::build(BandTable &table, const float *endHz, const float *gain) const
+{
+    float bandStartHz = startHz_;
+
+    // Same check as for stored presets, gains come from BLE as raw floats
+    if (!areBandGainsValid(gain, BandTable::kBandCount))
+    {
+        log_e("Invalid band gains, NaN, infinite or negative");
+        return false;
+    }
+
+    for (uint8_t bandIdx = 0; bandIdx < BandTable::kBandCount; bandIdx++)
+    {
+        // Check the edge before it is converted to a bin index, NaN fails every comparison
+        if (!(isfinite(endHz[bandIdx]) && endHz[bandIdx] > bandStartHz && endHz[bandIdx] / freqStep_ <= binCount_))
+        {
+            log_e("Invalid end frequency %.0f Hz for frequency band no. %d", endHz[bandIdx], bandIdx);
+            return false;
+        }
+
+        // Compute index of first and last frequency bin of current band
+        int32_t binIdxStart = (int32_t)ceilf(bandStartHz / freqStep_);
+        int32_t binIdxEnd = (int32_t)ceilf(endHz[bandIdx] / freqStep_) - 1;
+
+        // A band narrower than a bin, e.g. at small FFT sizes, shares the nearest bin with its neighbour
+        if (binIdxEnd < binIdxStart)
+        {
+            binIdxStart = binIdxEnd = max(1L, lroundf(0.5f * (bandStartHz + endHz[bandIdx]) / freqStep_));
+        }
+
+        table.binIdxStart[bandIdx] = binIdxStart;
+        table.binIdxEnd[bandIdx] = binIdxEnd;
+        table.gain[bandIdx] = gain[bandIdx];
+        table.endHz[bandIdx] = endHz[bandIdx];
+
+        log_d("Bins in band %d: %d to %d. Number of bins: %d.",
+              bandIdx, binIdxStart, binIdxEnd, binIdxEnd - binIdxStart + 1);
+
+        // Set start of next band
+        bandStartHz = endHz[bandIdx];
+    }
+
+    return buildFilters(table);
+}
+
+bool BandTables::buildFilters(BandTable &table) const
+{
+    const uint8_t bandCount = BandTable::kBandCount;
+    uint16_t weightCount = 0;
+
+    // Band centers in (fractional) bins, from the edges so that bands sharing a bin stay apart
+    float center[bandCount];
+    float width[bandCount];
+    float bandStart = startHz_ / freqStep_;
+
+    for (uint8_t bandIdx = 0; bandIdx < bandCount; bandIdx++)
+    {
+        float bandEnd = table.endHz[bandIdx] / freqStep_;
+        center[bandIdx] = 0.5f * (bandStart + bandEnd);
+        width[bandIdx] = bandEnd - bandStart;
+        bandStart = bandEnd;
+    }
+
+    for (uint8_t bandIdx = 0; bandIdx < bandCount; bandIdx++)
+    {
+        // The feet are the neighbouring centers, but a narrow band next to a wide one
+        // reaches at most its own width past its edges; the outer bands end at their edges
+        float lower = table.binIdxStart[bandIdx] - 1.0f;
+        float upper = table.binIdxEnd[bandIdx] + 1.0f;
+
+        if (bandIdx > 0)
+            lower = max(center[bandIdx - 1], center[bandIdx] - 1.5f * width[bandIdx]);
+
+        if (bandIdx < bandCount - 1)
+            upper = min(center[bandIdx + 1], center[bandIdx] + 1.5f * width[bandIdx]);
+
+        // Bins strictly between the feet, the feet themselves have zero weight; never the DC bin
+        int32_t first = max((int32_t)floorf(lower) + 1, (int32_t)1);
+        int32_t last = min((int32_t)ceilf(upper) - 1, (int32_t)binCount_ - 1);
+
+        // A foot may be closer than one bin, keep at least the bin nearest to the center
+        bool isSingleBin = first > last;
+
+        if (isSingleBin)
+        {
+            first = last = max(1L, lroundf(center[bandIdx]));
+        }
+
+        uint16_t length = last - first + 1;
+
+        if (weightCount + length > BandTable::kMaxWeights)
+        {
+            log_e("Too many filter weights for frequency band no. %d", bandIdx);
+            return false;
+        }
+
+        table.filterStart[bandIdx] = first;
+        table.filterLength[bandIdx] = length;
+        table.filterOffset[bandIdx] = weightCount;
+
+        uint8_t peakWeight = 1;
+
+        for (int32_t binIdx = first; binIdx <= last; binIdx++)
+        {
+            float w = isSingleBin                 ? 1.0f
+                      : binIdx <= center[bandIdx] ? (binIdx - lower) / (center[bandIdx] - lower)
+                                                  : (upper - binIdx) / (upper - center[bandIdx]);
+
+            // Never drop a bin completely, so narrow bands keep every bin they own
+            uint8_t weight = max(1, (int)lroundf(w * 255.0f));
+
+            table.weights[weightCount++] = weight;
+            peakWeight = max(peakWeight, weight);
+        }
+
+        // Narrow filters may peak between two bins, below 255
+        table.norm[bandIdx] = 1.0f / peakWeight;
+    }
+
+    log_d("Filterbank uses %d weights.", weightCount);
+
+    return true;
+}
+
+bool BandTables::publish(const float *endHz, const float *gain)
+{
+    BandTable *active = active_.load();
+    BandTable *inUse = inUse_.load();
+
+    BandTable *spare = &tables_[0];
+
+    while (spare == active || spare == inUse)
+    {
+        spare++;
+    }
+
+    if (!build(*spare, endHz, gain))
+        return false;
+
+    active_.store(spare);
+    swapCount_++;
+
+    return true;
+}
+
+bool BandTables::update(const float *endHz, const float *gain)
+{
+    if (writerMutex_ == nullptr)
+        return false;
+
+    xSemaphoreTake(writerMutex_, portMAX_DELAY);
+    bool success = publish(endHz, gain);
+    xSemaphoreGive(writerMutex_);
+
+    return success;
+}
+
+bool BandTables::setResolution(float freqStep, uint16_t binCount)
+{
+    if (writerMutex_ == nullptr)
+        return false;
+
+    xSemaphoreTake(writerMutex_, portMAX_DELAY);
+
+    float previousStep = freqStep_;
+    uint16_t previousCount = binCount_;
+
+    freqStep_ = freqStep;
+    binCount_ = binCount;
+
+    // Rebuild the published edges and gains for the new bins, or keep the old resolution
+    const BandTable *active = active_.load();
+    bool success = publish(active->endHz, active->gain);
+
+    if (!success)
+    {
+        freqStep_ = previousStep;
+        binCount_ = previousCount;
+    }
+
+    xSemaphoreGive(writerMutex_);
+
+    return success;
+}
+
+bool BandTables::updateGains(const float *gain)
+{
+    if (writerMutex_ == nullptr)
+        return false;
+
+    xSemaphoreTake(writerMutex_, portMAX_DELAY);
+
+    // Keep the edges of the published table, it cannot change while the mutex is held
+    bool success = publish(active_.load()->endHz, gain);
+    xSemaphoreGive(writerMutex_);
+
+    return success;
+}
+
+const BandTable &BandTables::acquire()
+{
+    BandTable *table = active_.load();
+
+    // Announce the table, then make sure it was not replaced in between; otherwise a
+    // writer may have missed the announcement and picked this slot as its spare
+    for (;;)
+    {
+        inUse_.store(table);
+
+        BandTable *latest = active_.load();
+
+        if (latest == table)
+            return *table;
+
+        table = latest;
+    }
+}
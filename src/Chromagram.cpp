@@ -0,0 +1,80 @@
+#include "Chromagram.h"
+
+bool Chromagram::begin(float freqStep, uint16_t binCount, float maxHz)
+{
+    if (binCount > kMaxBins || freqStep <= 0.0f)
+    {
+        log_e("Chromagram does not support %d bins", binCount);
+        return false;
+    }
+
+    // A bin resolves a semitone once it is narrower than the distance to the next note
+    const float semitoneRatio = 1.059463f;
+    float minHz = freqStep / (semitoneRatio - 1.0f);
+
+    uint16_t usedBins = 0;
+
+    for (uint16_t binIdx = 0; binIdx < binCount; binIdx++)
+    {
+        float freq = binIdx * freqStep;
+
+        if (freq < minHz || freq > maxHz)
+        {
+            pitchClass_[binIdx] = kPitchClassCount;
+            continue;
+        }
+
+        // Semitones relative to A4, A is pitch class 9
+        int note = (int)lroundf(12.0f * log2f(freq / 440.0f)) + 9;
+        pitchClass_[binIdx] = ((note % 12) + 12) % 12;
+        usedBins++;
+    }
+
+    log_d("Chromagram uses %d bins from %.0f Hz to %.0f Hz", usedBins, minHz, maxHz);
+
+    return usedBins > 0;
+}
+
+void Chromagram::update()
+{
+    float maxEnergy = 0.0f;
+    uint8_t loudest = 0;
+
+    for (uint8_t i = 0; i < kPitchClassCount; i++)
+    {
+        smoothed_[i] += (energy_[i] - smoothed_[i]) * smoothing;
+        energy_[i] = 0.0f;
+
+        if (smoothed_[i] > maxEnergy)
+        {
+            maxEnergy = smoothed_[i];
+            loudest = i;
+        }
+    }
+
+    energy_[kPitchClassCount] = 0.0f;
+
+    float scale = (maxEnergy > 0.0f) ? 255.0f / maxEnergy : 0.0f;
+
+    for (uint8_t i = 0; i < kPitchClassCount; i++)
+    {
+        level_[i] = smoothed_[i] * scale;
+    }
+
+    if (smoothed_[loudest] > smoothed_[dominant_] * switchMargin)
+    {
+        dominant_ = loudest;
+    }
+
+    // Each step on the circle of fifths is 7 semitones
+    uint8_t target = (((dominant_ * 7) % kPitchClassCount) * 256 + kPitchClassCount / 2) / kPitchClassCount;
+
+    // Wrapping difference, so the hue takes the short way around the color wheel
+    int8_t distance = (int8_t)(target - hue_);
+    int8_t step = distance / (1 << hueRate);
+
+    if (step == 0 && distance != 0)
+        step = (distance > 0) ? 1 : -1;
+
+    hue_ += step;
+}
@@ -0,0 +1,57 @@
+#include "CpuLoad.h"
+#include <esp_freertos_hooks.h>
+
+CpuLoad cpuLoad;
+
+static_assert(CpuLoad::kCoreCount == portNUM_PROCESSORS, "One load counter per core");
+
+// Written by the tick hook of each core only
+static TaskHandle_t idleTasks_[CpuLoad::kCoreCount] = {nullptr};
+static volatile uint16_t windowTicks_[CpuLoad::kCoreCount] = {0};
+static volatile uint16_t idleTicks_[CpuLoad::kCoreCount] = {0};
+static volatile uint8_t busyPercent_[CpuLoad::kCoreCount] = {0};
+
+static void IRAM_ATTR sampleTick()
+{
+    BaseType_t core = xPortGetCoreID();
+
+    if (xTaskGetCurrentTaskHandle() == idleTasks_[core])
+    {
+        idleTicks_[core]++;
+    }
+
+    if (++windowTicks_[core] >= CpuLoad::kWindowTicks)
+    {
+        busyPercent_[core] = 100 - (uint32_t)idleTicks_[core] * 100 / CpuLoad::kWindowTicks;
+        windowTicks_[core] = 0;
+        idleTicks_[core] = 0;
+    }
+}
+
+bool CpuLoad::begin()
+{
+    for (uint8_t core = 0; core < kCoreCount; core++)
+    {
+        idleTasks_[core] = xTaskGetIdleTaskHandleForCPU(core);
+
+        if (esp_register_freertos_tick_hook_for_cpu(sampleTick, core) != ESP_OK)
+        {
+            log_e("Failed to register the load hook of core %d.", core);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint8_t CpuLoad::percent(uint8_t core) const
+{
+    return (core < kCoreCount) ? busyPercent_[core] : 0;
+}
+
+size_t CpuLoad::format(char *buffer, size_t size) const
+{
+    size_t len = snprintf(buffer, size, "cpu0:%u%% cpu1:%u%%\n", busyPercent_[0], busyPercent_[1]);
+
+    return (len < size) ? len : size - 1;
+}
@@ -0,0 +1,17 @@
+#include "Crc16.h"
+
+// Nibble table for CRC-16/CCITT-FALSE (polynomial 0x1021)
+static const uint16_t kCrc16Table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF};
+
+uint16_t crc16Ccitt(const uint8_t *data, size_t length, uint16_t crc)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = (crc << 4) ^ kCrc16Table[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ kCrc16Table[(crc >> 12) ^ (data[i] & 0x0F)];
+    }
+
+    return crc;
+}
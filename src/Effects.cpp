@@ -0,0 +1,354 @@
+#include "Effects.h"
+
+/* ----- Primary effects ----- */
+
+void DefaultSoundFx::renderFrame(const EffectContext &ctx, CRGB *leds)
+{
+    const StripLayout &layout = *ctx.layout;
+    bool isPitchColored = followPitch && ctx.chroma != nullptr;
+    uint8_t hueShift = isPitchColored ? ctx.chroma->hue() : 0;
+
+    for (uint16_t i = 0; i < layout.halfSize(); i++)
+    {
+        const LedMapEntry &entry = layout[i];
+
+        if (entry.role == LedRole::Bass)
+        {
+            leds[i].setHSV(bassHue, 255, ctx.beatIntensity);
+        }
+        else
+        {
+            leds[i] = paletteLookup(*ctx.palette, entry.hue + hueShift, StripLayout::level(entry, ctx.lightness, ctx.peaks));
+        }
+
+        leds[entry.mirror] = leds[i];
+        ctx.power->add(leds[i], (entry.mirror == i) ? 1 : 2);
+    }
+
+    // The bass shows the complement of the pitch color, otherwise it slowly changes color
+    if (isPitchColored)
+        bassHue = hueShift + 128;
+    else
+        bassHue++;
+}
+
+void TwoToneSoundFx::renderFrame(const EffectContext &ctx, CRGB *leds)
+{
+    const StripLayout &layout = *ctx.layout;
+
+    for (uint16_t i = 0; i < layout.halfSize(); i++)
+    {
+        const LedMapEntry &entry = layout[i];
+
+        if (entry.role == LedRole::Bass)
+        {
+            leds[i].setHSV(bassHue, 255, ctx.beatIntensity);
+            leds[entry.mirror] = leds[i];
+            ctx.power->add(leds[i], (entry.mirror == i) ? 1 : 2);
+            continue;
+        }
+
+        // Colors alternate every 5 bands and swap every 8 beats
+        uint8_t group = entry.band / 5;
+        bool isColorOne = ((group % 2) == 0) == (ctx.beatModifier == 0);
+
+        // The palette index keeps increasing within a group of bands
+        uint8_t index = (isColorOne ? 0 : 128) + colorStep * (entry.band - group * 5);
+
+        leds[i] = paletteLookup(*ctx.palette, index, StripLayout::level(entry, ctx.lightness, ctx.peaks));
+        leds[entry.mirror] = leds[i];
+        ctx.power->add(leds[i], (entry.mirror == i) ? 1 : 2);
+    }
+}
+
+void SolidFx::renderFrame(const EffectContext &ctx, CRGB *leds)
+{
+    CRGB color;
+    color.setHSV(hue, saturation, brightness);
+
+    fill_solid(leds, ctx.layout->size(), color);
+    ctx.power->add(color, ctx.layout->size());
+}
+
+void OffFx::renderFrame(const EffectContext &ctx, CRGB *leds)
+{
+    fill_solid(leds, ctx.layout->size(), CRGB::Black);
+}
+
+void WaterfallFx::renderFrame(const EffectContext &ctx, CRGB *leds)
+{
+    const MatrixLayout *matrix = ctx.matrix;
+
+    if (matrix == nullptr || ctx.lightness == nullptr)
+    {
+        fill_solid(leds, ctx.layout->size(), CRGB::Black);
+        return;
+    }
+
+    uint8_t width = matrix->width();
+    uint8_t height = matrix->height();
+    uint8_t bandCount = ctx.layout->bandCount();
+
+    // The newest row replaces the oldest one, which is the row below it in the ring
+    newestRow_ = (newestRow_ == 0 || newestRow_ >= height) ? height - 1 : newestRow_ - 1;
+
+    uint8_t *newest = history_[newestRow_];
+
+    for (uint8_t x = 0; x < width; x++)
+    {
+        uint8_t firstBand = x * bandCount / width;
+        uint8_t endBand = max((x + 1) * bandCount / width, firstBand + 1);
+        uint8_t level = 0;
+
+        for (uint8_t band = firstBand; band < endBand; band++)
+        {
+            level = max(level, ctx.lightness[band]);
+        }
+
+        newest[x] = level;
+    }
+
+    // Row y shows the frame from y frames ago
+    uint8_t historyRow = newestRow_;
+
+    for (uint8_t y = 0; y < height; y++)
+    {
+        const uint8_t *levels = history_[historyRow];
+        const uint16_t *pixels = matrix->row(y);
+
+        for (uint8_t x = 0; x < width; x++)
+        {
+            CRGB &led = leds[pixels[x]];
+            led = paletteLookup(*ctx.palette, x * hueSpan / width, levels[x]);
+            ctx.power->add(led);
+        }
+
+        if (++historyRow == height)
+            historyRow = 0;
+    }
+}
+
+void IdleFx::renderFrame(const EffectContext &ctx, CRGB *leds)
+{
+    const StripLayout &layout = *ctx.layout;
+    uint8_t level = 8 + scale8(sin8(phase_), maxBrightness);
+
+    for (uint16_t i = 0; i < layout.size(); i++)
+    {
+        leds[i] = paletteLookup(*ctx.palette, layout[i].hue + drift_, level);
+        ctx.power->add(leds[i]);
+    }
+
+    phase_ += 3;
+    drift_++;
+}
+
+/* ----- Modifiers ----- */
+
+void SparkleModifier::renderFrame(const EffectContext &ctx, CRGB *leds)
+{
+    const StripLayout &layout = *ctx.layout;
+    uint16_t numLeds = layout.size();
+
+    if (numLeds == 0)
+        return;
+
+    if (!isSeeded_)
+    {
+        rng_.seed(micros());
+        isSeeded_ = true;
+    }
+
+    // Beat emitter: a burst of drifting sparkles on each beat onset
+    if (ctx.beatIntensity > lastBeatIntensity_)
+    {
+        for (uint8_t i = 0; i < beatBurst; i++)
+        {
+            int16_t velocity = (int16_t)rng_.below(129) - 64;
+            particles_.spawn((int32_t)rng_.below(numLeds) << 8, velocity, 255, 8 + rng_.below(16));
+        }
+    }
+
+    lastBeatIntensity_ = ctx.beatIntensity;
+
+    // Band emitter: probe random LEDs and let loud bands twinkle
+    for (uint8_t i = 0; i < bandProbes; i++)
+    {
+        uint16_t ledIdx = rng_.below(numLeds);
+        const LedMapEntry &entry = layout[ledIdx];
+
+        if (entry.role == LedRole::Bass)
+            continue;
+
+        uint8_t level = StripLayout::level(entry, ctx.lightness);
+
+        if (level >= bandThreshold && rng_.below(256) < level)
+        {
+            particles_.spawn((int32_t)ledIdx << 8, 0, level, 12);
+        }
+    }
+
+    // Ambient emitter: an occasional sparkle, also while the music is quiet
+    if (ambientDelay_ == 0)
+    {
+        particles_.spawn((int32_t)rng_.below(numLeds) << 8, 0, 255, 10);
+        ambientDelay_ = 25 + rng_.below(50);
+    }
+    else
+    {
+        ambientDelay_--;
+    }
+
+    particles_.updateAndRender(leds, numLeds, *ctx.power);
+}
+
+/* ----- Engine ----- */
+
+// Blend of both palettes during a palette-only crossfade, shared as the engines render one after another
+static CRGBPalette256 fadePalette_;
+
+void EffectEngine::select(EffectId effect, PaletteId palette, uint16_t fadeMillis)
+{
+    if (effect == activeEffect && palette == paletteId_)
+        return;
+
+    fadeFromEffect_ = activeEffect;
+    fadeStartMillis_ = millis();
+    fadeMillis_ = fadeMillis;
+
+    // Compile the new palette into the slot of the one faded out from
+    if (palette != paletteId_)
+    {
+        activePalette_ ^= 1;
+        compilePalette(palette, palettes_[activePalette_]);
+        paletteId_ = palette;
+    }
+    else
+    {
+        palettes_[activePalette_ ^ 1] = palettes_[activePalette_];
+    }
+
+    activeEffect = effect;
+}
+
+void EffectEngine::applyDynamics(EffectContext &ctx, EffectId effect) const
+{
+    if (hasDynamics(effect) && ctx.lightness != nullptr)
+    {
+        ctx.lightness = dynamics.levels();
+        ctx.peaks = dynamics.peaks();
+    }
+}
+
+void EffectEngine::render(const EffectContext &ctx, CRGB *leds, CRGB *fadeBuffer)
+{
+    // Run the meter every frame, so it is settled when an effect switches it on
+    if (ctx.lightness != nullptr)
+    {
+        dynamics.process(ctx.lightness);
+    }
+
+    EffectContext current = ctx;
+    current.palette = &palettes_[activePalette_];
+    applyDynamics(current, activeEffect);
+
+    fract8 amount = 255;
+
+    if (fadeMillis_ > 0)
+    {
+        unsigned long elapsedMillis = millis() - fadeStartMillis_;
+
+        if (elapsedMillis >= fadeMillis_)
+        {
+            fadeMillis_ = 0;
+        }
+        else
+        {
+            amount = (elapsedMillis * 255) / fadeMillis_;
+        }
+    }
+
+    bool isPaletteFade = fadeMillis_ > 0 && fadeFromEffect_ == activeEffect;
+
+    if (isPaletteFade)
+    {
+        // Same effect: render it once through a blend of both palettes, rendering the
+        // stateful effect twice would advance it twice per frame
+        const CRGBPalette256 &from = palettes_[activePalette_ ^ 1];
+        const CRGBPalette256 &to = palettes_[activePalette_];
+
+        for (uint16_t i = 0; i < 256; i++)
+        {
+            fadePalette_[i] = blend(from[i], to[i], amount);
+        }
+
+        current.palette = &fadePalette_;
+    }
+
+    uint32_t loadBefore = ctx.power->load();
+
+    effects.render((uint8_t)activeEffect, current, leds);
+
+    if (fadeMillis_ > 0 && !isPaletteFade)
+    {
+        // Render the previous effect with its palette into the second frame buffer and blend both
+        PowerMeter fadePower;
+        EffectContext previous = ctx;
+        previous.palette = &palettes_[activePalette_ ^ 1];
+        previous.power = &fadePower;
+        applyDynamics(previous, fadeFromEffect_);
+
+        effects.render((uint8_t)fadeFromEffect_, previous, fadeBuffer);
+
+        // The blended frame replaces the load counted for the current effect
+        ctx.power->reset(loadBefore);
+
+        for (uint16_t i = 0; i < ctx.layout->size(); i++)
+        {
+            leds[i] = blend(fadeBuffer[i], leds[i], amount);
+            ctx.power->add(leds[i]);
+        }
+    }
+
+    for (uint8_t id = 0; id < ModifierRegistry::kCount; id++)
+    {
+        if ((activeModifiers & (1 << id)) && !areModifiersSuspended)
+        {
+            modifiers.render(id, ctx, leds);
+        }
+    }
+}
+
+void EffectEngine::renderIdle(const EffectContext &ctx, CRGB *leds)
+{
+    EffectContext current = ctx;
+    current.palette = &palettes_[activePalette_];
+
+    if (activeEffect == EffectId::Off || activeEffect == EffectId::Solid)
+    {
+        effects.render((uint8_t)activeEffect, current, leds);
+    }
+    else
+    {
+        idle.render(current, leds);
+    }
+}
+
+void EffectEngine::printStats() const
+{
+    for (uint8_t id = 0; id < EffectRegistry::kCount; id++)
+    {
+        const LayerStats &stats = effects.stats(id);
+        Serial.printf("Effect %s: %u frames, last %u us, max %u us, avg %u us\n", effects.name(id),
+                      stats.frames, stats.lastMicros, stats.maxMicros,
+                      stats.frames ? stats.totalMicros / stats.frames : 0);
+    }
+
+    for (uint8_t id = 0; id < ModifierRegistry::kCount; id++)
+    {
+        const LayerStats &stats = modifiers.stats(id);
+        Serial.printf("Modifier %s: %u frames, last %u us, max %u us, avg %u us\n", modifiers.name(id),
+                      stats.frames, stats.lastMicros, stats.maxMicros,
+                      stats.frames ? stats.totalMicros / stats.frames : 0);
+    }
+}
@@ -1,4 +1,15 @@
 #include "FFTProcessor.h"
+#include "AnalysisFrame.h"
+#include "BandTable.h"
+#include "Chromagram.h"
+#include "SampleConditioning.h"
+#include "SilenceDetector.h"
+#include "StageProfiler.h"
+#include "Telemetry.h"
+
+#ifdef AUDIOVIS_RAW_CAPTURE
+#include "AudioCapture.h"
+#endif
 
 FFTProcessor::FFTProcessor()
 {
@@ -32,18 +43,93 @@ const uint16_t kSampleRate = 44100; // Unit: Hz
 
 /* ----- FFT constants ----- */
 typedef float fftData_t;
-const uint8_t kFFT_SampleCountLog2 = 11;
-const uint16_t kFFT_SampleCount = 1 << kFFT_SampleCountLog2;
-const fftData_t kFFT_SampleCountInv = 1.0f / kFFT_SampleCount;
 const fftData_t kFFT_SamplingFreq = (fftData_t)kSampleRate;
-const uint16_t kFFT_FreqBinCount = kFFT_SampleCount / 2;
-const float kFFT_FreqStep = kFFT_SamplingFreq / kFFT_SampleCount;
+
+// Block sizes selectable at runtime, from low latency (512) to high resolution (4096)
+const uint8_t kFFT_MinSampleCountLog2 = 9;
+const uint8_t kFFT_MaxSampleCountLog2 = 12;
+const uint8_t kFFT_DefaultSampleCountLog2 = 11;
+const uint8_t kFFT_ModeCount = kFFT_MaxSampleCountLog2 - kFFT_MinSampleCountLog2 + 1;
+const uint16_t kFFT_MaxSampleCount = 1 << kFFT_MaxSampleCountLog2;
+const uint16_t kFFT_MaxFreqBinCount = kFFT_MaxSampleCount / 2;
+
+// Magnitudes are scaled to this size, so a tone has the same level at every size
+const uint16_t kFFT_ReferenceSampleCount = 2048;
+
+/* ----- Analysis arena ----- */
+
+/*
+    All working memory of the analysis pipeline, sized at compile time for the
+    largest block and shared by all block sizes. Buffers whose lifetimes do not
+    overlap share storage:
+
+    - The i2s sample block of N samples is only alive until conditioning. It
+      occupies the second half of the first 4N bytes of the FFT real part;
+      conditioning writes real[i] (bytes 4i..4i+3) after reading sample i
+      (byte 2N+2i), so it never overwrites an unread sample.
+    - The FFT real and imaginary parts are dead after the spectrum stage.
+    - The averaged magnitude spectrum persists across frames.
+*/
+struct AnalysisArena
+{
+    union
+    {
+        fftData_t fftDataReal[kFFT_MaxSampleCount];
+        int16_t micRead[2 * kFFT_MaxSampleCount];
+    };
+    fftData_t fftDataImag[kFFT_MaxSampleCount];
+    fftData_t magnitudeSpectrumAvg[kFFT_MaxFreqBinCount];
+};
+
+const size_t kAnalysisArenaBudget = 40 * 1024;
+const size_t kAnalysisArenaAliased = kFFT_MaxSampleCount * sizeof(int16_t);
+
+static_assert(sizeof(fftData_t) == 2 * sizeof(int16_t), "Sample block aliasing assumes 32 bit FFT data");
+static_assert(sizeof(AnalysisArena) <= kAnalysisArenaBudget, "Analysis arena exceeds its RAM budget");
+
+AnalysisArena arena_ = {};
 
 /* ----- FFT variables ----- */
-fftData_t fftDataReal_[kFFT_SampleCount] = {0.0};
-fftData_t fftDataImag_[kFFT_SampleCount] = {0.0};
-fftData_t magnitudeSpectrumAvg_[kFFT_FreqBinCount] = {0};
-ArduinoFFT<fftData_t> fft_ = ArduinoFFT<fftData_t>(fftDataReal_, fftDataImag_, kFFT_SampleCount, kFFT_SamplingFreq); // Create FFT object
+fftData_t *const fftDataReal_ = arena_.fftDataReal;
+fftData_t *const fftDataImag_ = arena_.fftDataImag;
+fftData_t *const magnitudeSpectrumAvg_ = arena_.magnitudeSpectrumAvg;
+
+// One preplanned transform per block size, all working on the arena
+ArduinoFFT<fftData_t> fftPlans_[kFFT_ModeCount] = {
+    ArduinoFFT<fftData_t>(fftDataReal_, fftDataImag_, 512, kFFT_SamplingFreq),
+    ArduinoFFT<fftData_t>(fftDataReal_, fftDataImag_, 1024, kFFT_SamplingFreq),
+    ArduinoFFT<fftData_t>(fftDataReal_, fftDataImag_, 2048, kFFT_SamplingFreq),
+    ArduinoFFT<fftData_t>(fftDataReal_, fftDataImag_, 4096, kFFT_SamplingFreq)};
+
+static_assert(kFFT_ModeCount == 4 && kFFT_MinSampleCountLog2 == 9, "fftPlans_ must list every block size");
+
+/* Everything that depends on the block size */
+struct FftMode
+{
+    uint8_t sampleCountLog2;
+    uint16_t sampleCount;
+    uint16_t freqBinCount;
+    float freqStep;
+    fftData_t inputScale; // Normalizes int16 samples and the FFT gain of the block size
+    ArduinoFFT<fftData_t> *plan;
+};
+
+static FftMode makeFftMode(uint8_t sampleCountLog2)
+{
+    FftMode mode;
+    mode.sampleCountLog2 = sampleCountLog2;
+    mode.sampleCount = 1 << sampleCountLog2;
+    mode.freqBinCount = mode.sampleCount / 2;
+    mode.freqStep = kFFT_SamplingFreq / mode.sampleCount;
+    mode.inputScale = (1.0f / __INT16_MAX__) * kFFT_ReferenceSampleCount / mode.sampleCount;
+    mode.plan = &fftPlans_[sampleCountLog2 - kFFT_MinSampleCountLog2];
+    return mode;
+}
+
+FftMode fftMode_ = makeFftMode(kFFT_DefaultSampleCountLog2);
+volatile uint8_t requestedSampleCountLog2_ = 0; // Applied between two frames, 0 if none
+uint8_t preferredSampleCountLog2_ = kFFT_DefaultSampleCountLog2; // Size chosen by the user or preset
+bool isBlockSizeBoosted_ = false;                                // Overload: one size above the preferred
 
 /* ----- i2s hardware constants ----- */
 const i2s_port_t kI2S_Port = I2S_NUM_0;
@@ -53,16 +139,22 @@ const int kI2S_PinData = 34;
 /* ----- i2s constants ----- */
 const i2s_bits_per_sample_t kI2S_BitsPerSample = I2S_BITS_PER_SAMPLE_16BIT;
 const uint8_t kI2S_BytesPerSample = kI2S_BitsPerSample / 8;
-const uint16_t kI2S_ReadSizeBytes = kFFT_SampleCount * kI2S_BytesPerSample;
-const uint16_t kI2S_BufferSizeSamples = 1024;
+const uint16_t kI2S_BufferSizeSamples = 1 << kFFT_MinSampleCountLog2; // Every block size is a whole number of buffers
 const uint16_t kI2S_BufferSizeBytes = kI2S_BufferSizeSamples * kI2S_BytesPerSample;
-const uint16_t kI2S_BufferCount = (3 * kFFT_SampleCount) / (2 * kI2S_BufferSizeSamples);
-const uint8_t kI2S_BufferCountPerFFT = kFFT_SampleCount / kI2S_BufferSizeSamples;
+const uint16_t kI2S_BufferCount = 6; // About 70 ms of audio, covers the processing of a block of any size
 const int kI2S_QueueLength = 16;
+const TickType_t kI2S_TimeoutTicks = 100 / portTICK_PERIOD_MS; // Microphone stalled if no buffer arrives this long
+
+/* ----- i2s event task ----- */
+const uint32_t kI2S_EventTaskStackSize = 2048;
+const UBaseType_t kI2S_EventTaskPriority = 5; // Above the loop task, it only forwards events
 
 /* ----- i2s variables ----- */
-int16_t micReadBuffer_[kFFT_SampleCount] = {0};
+int16_t *micReadBuffer_ = arena_.micRead + fftMode_.sampleCount; // Aliased, see AnalysisArena
+int16_t dcOffset_ = 0;
 QueueHandle_t pI2S_Queue_ = nullptr;
+TaskHandle_t analysisTask_ = nullptr; // Notified once per filled DMA buffer
+volatile uint32_t i2sDmaErrors_ = 0;
 
 // Frequency bands
 // Source: https://www.teachmeaudio.com/mixing/techniques/audio-spectrum
@@ -100,24 +192,109 @@ const float kFreqBandAmp[kFreqBandCount] = {
     1,1,1,1,1,1,1,1,1,1,1,1,1,1,1, 
     .8f};
 
+static_assert(kFreqBandCount == kPresetBandCount, "Presets must hold a gain for each frequency band");
+static_assert(kFreqBandCount == BandTable::kBandCount, "Band tables must hold all frequency bands");
 
-fftData_t sensitivityFactor_ = 1;
-const float kSensitivityFactorMax = 1000.0f;
+// Band edges and gains in use, initialized from the constants above and replaced at runtime
+BandTables bandTables_;
 
-float magnitudeBandMax_[kFreqBandCount] = {0.0f};
+// Pitch classes of the averaged spectrum
+Chromagram chromagram_;
 
-/* Start indices, end indices and normalization factors for each frequency band
-    The indices relate to the frequency bins resulting from the FFT */
-uint16_t freqBandBinIdxStart_[kFreqBandCount] = {0};
-uint16_t freqBandBinIdxEnd_[kFreqBandCount] = {0};
-uint16_t freqBandBinCount_[kFreqBandCount] = {0};
+fftData_t sensitivityFactor_ = 1;
+const float kSensitivityFactorMax = 1000.0f;
+float sensitivityFactorMax_ = kSensitivityFactorMax;
 
 /* ----- Beat detection constants and variables ----- */
 const uint8_t kBeatDetectBand = 1;
 const float kBeatThreshold = 4.0f;
+float beatThreshold_ = kBeatThreshold;
 float beatHist_[3] = {0.0f};
 bool isBeatHit = false;
-int lightness[kFreqBandCount];
+
+// Published result of the last block, and the features collected in the magnitude loop
+AnalysisFrame analysisFrame_ = {};
+SpectrumFeatures spectrumFeatures_;
+
+static_assert(kFreqBandCount == AnalysisFrame::kBandCount, "Analysis frames must hold all frequency bands");
+
+/* ----- Idle mode ----- */
+const uint32_t kIdleCpuMhz = 80; // CPU frequency while idle, 0 keeps the frequency unchanged
+
+SilenceDetector silenceDetector_;
+bool isIdle_ = false;
+uint32_t activeCpuMhz_ = 0;
+
+/*
+    Drains the i2s event queue and gives the analysis task one notification per
+    filled DMA buffer, so the analysis sleeps until its data is there instead
+    of polling the queue. The notification value counts the buffers that are
+    ready but not yet read.
+*/
+static void i2sEventTask(void *param)
+{
+    i2s_event_t i2sEvent = {};
+
+    for (;;)
+    {
+        if (xQueueReceive(pI2S_Queue_, (void *)&i2sEvent, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        switch (i2sEvent.type)
+        {
+        case I2S_EVENT_RX_DONE:
+            xTaskNotifyGive(analysisTask_);
+            break;
+
+        case I2S_EVENT_DMA_ERROR:
+            i2sDmaErrors_++;
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+/*
+    Wait for the next DMA buffer and read it into 'dest'. Returns the number of
+    buffers that were ready before this one was taken, minus one, i.e. the
+    backlog. The blocked time is added to 'waitTicks'.
+*/
+static uint32_t readBuffer(int16_t *dest, size_t &bytesRead, esp_err_t &err, uint32_t &waitTicks)
+{
+    uint32_t start = stageProfiler.now();
+    uint32_t ready = ulTaskNotifyTake(pdFALSE, kI2S_TimeoutTicks);
+
+    if (ready == 0)
+    {
+        err = ESP_ERR_TIMEOUT;
+    }
+
+    // The driver queues the buffer before the event, so this returns at once; the
+    // timeout only matters if buffers were dropped and the count ran ahead of them
+    size_t chunkBytesRead = 0;
+    esp_err_t chunkErr = i2s_read(kI2S_Port, dest, kI2S_BufferSizeBytes, &chunkBytesRead, kI2S_TimeoutTicks);
+
+    if (chunkErr)
+    {
+        err = chunkErr;
+    }
+
+    bytesRead += chunkBytesRead;
+    waitTicks += stageProfiler.now() - start;
+
+    uint32_t backlog = (ready > 0) ? ready - 1 : 0;
+
+    // More than the DMA ring can hold: the driver dropped buffers, resynchronize the count
+    if (backlog >= kI2S_BufferCount)
+    {
+        ulTaskNotifyTake(pdTRUE, 0);
+        backlog = kI2S_BufferCount;
+    }
+
+    return backlog;
+}
 
 bool FFTProcessor::setupI2Smic()
 {
@@ -156,6 +333,16 @@ bool FFTProcessor::setupI2Smic()
         return false;
     }
 
+    // The analysis runs on the task calling setup(), next to the event task on the same core
+    analysisTask_ = xTaskGetCurrentTaskHandle();
+
+    if (xTaskCreatePinnedToCore(i2sEventTask, "i2sEvents", kI2S_EventTaskStackSize, nullptr,
+                                kI2S_EventTaskPriority, nullptr, xPortGetCoreID()) != pdPASS)
+    {
+        log_e("Failed to start i2s event task.");
+        return false;
+    }
+
     // Configure i2s pins for sampling audio data from the built-in microphone of the M5StickC
     i2s_pin_config_t i2sPinConfig = {
         .bck_io_num = I2S_PIN_NO_CHANGE,
@@ -176,87 +363,260 @@ bool FFTProcessor::setupI2Smic()
 
 bool FFTProcessor::setupSpectrumAnalysis()
 {
-    bool success = true;
+    // One FFT block has to be processed before the next one has been sampled
+    stageProfiler.setFrameBudget((1000000UL * fftMode_.sampleCount) / kSampleRate);
+    stageProfiler.setCpuFrequency(getCpuFrequencyMhz());
+    activeCpuMhz_ = getCpuFrequencyMhz();
+
+    // Assign the frequency bins resulting from the FFT to the frequency bands
+    return bandTables_.begin(kFreqBandStartHz, fftMode_.freqStep, fftMode_.freqBinCount) &&
+           bandTables_.update(kFreqBandEndHz, kFreqBandAmp) &&
+           chromagram_.begin(fftMode_.freqStep, fftMode_.freqBinCount);
+}
+
+void FFTProcessor::printMemoryReport()
+{
+    const size_t dmaBytes = kI2S_BufferCount * kI2S_BufferSizeBytes;
+
+    Serial.printf("Analysis arena: %u bytes (budget %u, %u saved by aliasing)\n",
+                  sizeof(AnalysisArena), kAnalysisArenaBudget, kAnalysisArenaAliased);
+    Serial.printf("I2S DMA buffers: %u bytes on the heap\n", dmaBytes);
+    Serial.printf("FFT: %u points, %.1f Hz per bin\n", fftMode_.sampleCount, fftMode_.freqStep);
+    Serial.printf("Heap: %u free, %u minimum free, %u largest block\n",
+                  ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+    Serial.printf("Loop task stack: %u bytes never used\n", uxTaskGetStackHighWaterMark(nullptr));
+}
+
+unsigned long timeReadLastMicros_ = 0;
+uint8_t cycleNr_ = 1;
+const uint8_t kTelemetryGainInterval = 64;  // Frames between repeated band gain frames
+uint32_t telemetrySwapCount_ = UINT32_MAX; // Band table swap count of the last band gain frame
+uint8_t telemetryGainFrames_ = 0;
+float maxCurrent_ = 0.0f;
+float lastCurrent_ = 0.0f;
+volatile bool isDisplayEnabled_ = false; // Set once the display has been initialized in the background
+bool isDisplaySuspended_ = false;        // Overload: the display is not refreshed
+uint8_t queuedBuffers_ = 0;              // I2S buffers that arrived beyond the expected count in the last frame
+
+// Accumulated current readings [mA] for the power report, indexed by the idle state
+float currentSum_[2] = {0.0f};
+uint32_t currentCount_[2] = {0};
+
+/* Read the current drawn from USB or battery and keep its maximum for the display */
+static void readCurrent()
+{
+    // Determine current consumption from USB
+    float vBusCurrent = M5.Axp.GetVBusCurrent();
 
-    // Variables for bin indices and bin count belonging to the current frequency band
-    uint16_t binIdxStart; // Index of the first frequency bin of the current frequency band
-    uint16_t binIdxEnd;   // Index of the last frequency bin of the current frequency band
+    // Determine current consumption from battery
+    float batCurrent = 0.5f * M5.Axp.GetIdischargeData();
 
-    // Set bin index for the start of the first frequency band
-    binIdxStart = ceilf(kFreqBandStartHz / kFFT_FreqStep);
+    float current = max(vBusCurrent, batCurrent);
+    lastCurrent_ = current;
 
-    // Compute values for all frequency bands
-    for (uint8_t bandIdx = 0; bandIdx < kFreqBandCount; bandIdx++)
+    if (current > maxCurrent_)
     {
-        // Store index of first frequency bin of current band
-        if (binIdxStart < kFFT_FreqBinCount)
-        {
-            freqBandBinIdxStart_[bandIdx] = binIdxStart;
-        }
-        else
-        {
-            freqBandBinIdxStart_[bandIdx] = 0;
+        maxCurrent_ = current;
+    }
 
-            success = false;
+    currentSum_[isIdle_] += current;
+    currentCount_[isIdle_]++;
+}
 
-            log_e("Failed to set start bin index for frequency band no. %d", bandIdx);
-        }
+/* Show the maximum current since the last call on the display */
+static void showCurrent()
+{
+    M5.Lcd.setCursor(5, 80);
+    M5.Lcd.setTextSize(2);
+    M5.Lcd.setTextColor(WHITE, BLACK);
+    M5.Lcd.printf("%03.0f mA", maxCurrent_);
+    maxCurrent_ = 0;
+}
+
+static void setIdle(bool idle)
+{
+    isIdle_ = idle;
+
+    if (kIdleCpuMhz > 0)
+    {
+        setCpuFrequencyMhz(idle ? kIdleCpuMhz : activeCpuMhz_);
+        stageProfiler.setCpuFrequency(getCpuFrequencyMhz());
+    }
+
+    log_i("%s idle mode. Noise floor: %.1f", idle ? "Entering" : "Leaving", silenceDetector_.noiseFloor());
+}
+
+// Convert one DMA buffer of the block to FFT input, see SampleConditioning.h
+static void conditionChunk(uint16_t offset, BlockStats &stats)
+{
+    conditionSamples(micReadBuffer_ + offset, fftDataReal_ + offset, fftDataImag_ + offset,
+                     kI2S_BufferSizeSamples, dcOffset_, fftMode_.inputScale, stats);
+}
+
+/*
+    Idle mode: read a single DMA buffer into the first chunk of the block and
+    only compute its RMS. Returns true when sound is back; the chunk is then
+    kept as the start of the next analysis block.
+*/
+static bool watchSilence()
+{
+    size_t i2sBytesRead = 0;
+    esp_err_t i2sErr = ESP_OK;
+    uint32_t waitTicks = 0;
+
+    // A backlog does not matter while idle, the next reads catch up with it
+    readBuffer(micReadBuffer_, i2sBytesRead, i2sErr, waitTicks);
 
-        // Compute index of last frequency bin of current band
-        binIdxEnd = ceilf(kFreqBandEndHz[bandIdx] / kFFT_FreqStep) - 1;
+    if (i2sErr)
+    {
+        log_e("i2s_read failure. ESP error: %s (%x)", esp_err_to_name(i2sErr), i2sErr);
+    }
+
+#ifdef AUDIOVIS_RAW_CAPTURE
+    audioCapture.capture(micReadBuffer_, kI2S_BufferSizeSamples, micros());
+#endif
+
+    int32_t sum = 0;
+    uint64_t sumSquares = 0;
+
+    for (uint16_t i = 0; i < kI2S_BufferSizeSamples; i++)
+    {
+        int16_t v = micReadBuffer_[i] - dcOffset_;
+        sum += micReadBuffer_[i];
+        sumSquares += (int32_t)v * v;
+    }
 
-        if (binIdxEnd < kFFT_FreqBinCount)
+    dcOffset_ = sum / kI2S_BufferSizeSamples;
+
+    // Poll the AXP at a low rate for the idle power report, with the display on or off
+    if (cycleNr_ == 1)
+    {
+        readCurrent();
+
+        if (isDisplayEnabled_ && !isDisplaySuspended_)
         {
-            freqBandBinIdxEnd_[bandIdx] = binIdxEnd;
+            showCurrent();
         }
-        else
-        {
-            freqBandBinIdxEnd_[bandIdx] = 0;
-            binIdxEnd = kFFT_FreqBinCount - 1;
+    }
+
+    cycleNr_ = (cycleNr_ + 1) % 20;
+
+    return !silenceDetector_.update(sqrtf((float)sumSquares / kI2S_BufferSizeSamples), kI2S_BufferSizeSamples, millis());
+}
 
-            success = false;
+/*
+    Resample the averaged spectrum to the bins of another block size. Sizes are
+    powers of two, so each new bin takes the old bin at the same frequency.
+*/
+static void resampleSpectrum(const FftMode &from, const FftMode &to)
+{
+    if (to.sampleCountLog2 < from.sampleCountLog2)
+    {
+        // Fewer, wider bins: reads run ahead of the writes
+        uint8_t shift = from.sampleCountLog2 - to.sampleCountLog2;
 
-            log_e("Failed to set end bin index for frequency band no. %d", bandIdx);
+        for (uint16_t i = 0; i < to.freqBinCount; i++)
+        {
+            magnitudeSpectrumAvg_[i] = magnitudeSpectrumAvg_[i << shift];
         }
+    }
+    else
+    {
+        // More, narrower bins: fill from the top so no source bin is overwritten before use
+        uint8_t shift = to.sampleCountLog2 - from.sampleCountLog2;
 
-        // Compute bin count for current band
-        freqBandBinCount_[bandIdx] = binIdxEnd - binIdxStart + 1;
+        for (uint16_t i = to.freqBinCount; i-- > 0;)
+        {
+            magnitudeSpectrumAvg_[i] = magnitudeSpectrumAvg_[i >> shift];
+        }
+    }
+}
 
-        // Set binIdxStart for next band
-        binIdxStart = binIdxEnd + 1;
+/* Switch the block size between two frames; the sample stream continues without a gap */
+static void switchFftMode(uint8_t sampleCountLog2)
+{
+    FftMode mode = makeFftMode(sampleCountLog2);
 
-        log_d("Bins in band %d: %d to %d. Number of bins: %d.",
-              bandIdx,
-              freqBandBinIdxStart_[bandIdx], freqBandBinIdxEnd_[bandIdx],
-              freqBandBinCount_[bandIdx]);
+    if (!bandTables_.setResolution(mode.freqStep, mode.freqBinCount))
+    {
+        log_e("Frequency bands do not fit %d point FFT", mode.sampleCount);
+        return;
     }
 
-    return success;
-}
+    chromagram_.begin(mode.freqStep, mode.freqBinCount);
+    resampleSpectrum(fftMode_, mode);
 
-unsigned long timeReadLastMicros_ = 0;
-uint8_t userTrigger_ = 0;
-uint8_t cycleNr_ = 1;
-float maxCurrent_ = 0.0f;
+    fftMode_ = mode;
+    micReadBuffer_ = arena_.micRead + mode.sampleCount;
 
-/*
-uint16_t testSignalFreqFactor_ = 0;
-*/
+    stageProfiler.setFrameBudget((1000000UL * mode.sampleCount) / kSampleRate);
+    stageProfiler.reset();
+
+    log_i("FFT size %d: %.1f Hz per bin, %.1f ms per block",
+          mode.sampleCount, mode.freqStep, 1000.0f * mode.sampleCount / kSampleRate);
+}
 
 void FFTProcessor::loop()
 {
+    uint8_t requestedSampleCountLog2 = requestedSampleCountLog2_;
+
+    if (requestedSampleCountLog2 != 0)
+    {
+        requestedSampleCountLog2_ = 0;
+
+        if (requestedSampleCountLog2 != fftMode_.sampleCountLog2)
+            switchFftMode(requestedSampleCountLog2);
+    }
+
+    const uint16_t sampleCount = fftMode_.sampleCount;
 
     esp_err_t i2sErr = ESP_OK;
     size_t i2sBytesRead = 0;
+    BlockStats block;
+    uint16_t firstChunk = 0;
+
+    if (isIdle_)
+    {
+        if (!watchSilence())
+            return;
+
+        // Sound is back: the chunk just read starts a full analysis block
+        setIdle(false);
+        conditionChunk(0, block);
+        i2sBytesRead = kI2S_BufferSizeBytes;
+        firstChunk = kI2S_BufferSizeSamples;
+    }
 
     // Store time stamp for debug output
     unsigned long timeBeforeReadMicros = micros();
+    uint32_t waitTicks = 0;
+    uint32_t conditionTicks = 0;
+    uint32_t backlog = 0;
 
-    // Note: If the I2S DMA buffer is empty, 'i2s_read' blocks the current thread until data becomes available
-    i2sErr = i2s_read(kI2S_Port, micReadBuffer_, kI2S_ReadSizeBytes, &i2sBytesRead, 100 / portTICK_PERIOD_MS);
+    // Read the block one DMA buffer at a time, straight into the analysis arena
+    for (uint16_t offset = firstChunk; offset < sampleCount; offset += kI2S_BufferSizeSamples)
+    {
+        // Sleeps until the event task reports the buffer
+        backlog = readBuffer(micReadBuffer_ + offset, i2sBytesRead, i2sErr, waitTicks);
+
+#ifdef AUDIOVIS_RAW_CAPTURE
+        // Stream the untouched microphone samples, before they are overwritten by conditioning
+        audioCapture.capture(micReadBuffer_ + offset, kI2S_BufferSizeSamples, micros());
+#endif
+
+        // Condition all but the last chunk while the DMA is still filling the next buffer
+        if (offset + kI2S_BufferSizeSamples < sampleCount)
+        {
+            uint32_t conditionStart = stageProfiler.now();
+            conditionChunk(offset, block);
+            conditionTicks += stageProfiler.now() - conditionStart;
+        }
+    }
 
     // Get timestamp after reading
     unsigned long timeAferReadMicros = micros();
+    stageProfiler.recordTicks(Stage::I2SWait, waitTicks);
+    stageProfiler.beginFrame();
 
     // Compute read duration for debug output
     unsigned long timeInRead = timeAferReadMicros - timeBeforeReadMicros;
@@ -274,125 +634,54 @@ void FFTProcessor::loop()
     }
 
     // Check whether right number of bytes has been read
-    if (i2sBytesRead != kI2S_ReadSizeBytes)
+    if (i2sBytesRead != sampleCount * kI2S_BytesPerSample)
     {
         log_w("i2s_read unexpected number of bytes: %d", i2sBytesRead);
     }
 
-    // Analyse event queue to check whether i2s is working correctly
-    i2s_event_t i2sEvent = {};
-    uint8_t i2sEventRxDoneCount = 0;
-
-    uint8_t i2sMsgCount = uxQueueMessagesWaiting(pI2S_Queue_);
-
-    log_v("Number of I2S events waiting in queue: %d", i2sMsgCount);
-
-    // Iterate over all events in the i2s event queue
-    for (uint8_t i = 0; i < i2sMsgCount; i++)
-    {
-        // Take next event from queue
-        if (xQueueReceive(pI2S_Queue_, (void *)&i2sEvent, 0) == pdTRUE)
-        {
-            switch (i2sEvent.type)
-            {
-            case I2S_EVENT_DMA_ERROR:
-                log_e("I2S_EVENT_DMA_ERROR");
-                break;
-
-            case I2S_EVENT_TX_DONE:
-                log_v("I2S_EVENT_TX_DONE");
-                break;
-
-            // Count the number of "RX done" events
-            case I2S_EVENT_RX_DONE:
-                log_v("I2S_EVENT_RX_DONE");
-                i2sEventRxDoneCount += 1;
-                break;
-
-            case I2S_EVENT_MAX:
-                log_w("I2S_EVENT_MAX");
-                break;
-            }
-        }
-    }
-
-    // If there are more RX done events in the queue than expected, probably data processing takes too long
-    if (i2sEventRxDoneCount > kI2S_BufferCountPerFFT)
+    if (i2sDmaErrors_ > 0)
     {
-        log_w("Frame loss. Number of I2S_EVENT_RX_DONE events is: %d", i2sEventRxDoneCount);
+        log_e("I2S_EVENT_DMA_ERROR (%u)", i2sDmaErrors_);
+        i2sDmaErrors_ = 0;
     }
-    else
-    {
-        if (i2sEventRxDoneCount < kI2S_BufferCountPerFFT)
-        {
-            log_e("Configuration error? Number of I2S_EVENT_RX_DONE events is: %d", i2sEventRxDoneCount);
-        }
-    }
-
-    log_v("Read duration [µs]: %d. Duration since last read [µs]: %d", timeInRead, timeBetweenRead);
-
-    // Store start time of processing to compute duration later on
-    unsigned long timeStartMicros = micros();
 
-    // Compute sum of the current sample block
-    int32_t blockSum = micReadBuffer_[0];
+    // Buffers that were already full when the block was complete: processing takes too long
+    queuedBuffers_ = min(backlog, (uint32_t)UINT8_MAX);
 
-    for (uint16_t i = 1; i < kFFT_SampleCount; i++)
+    if (backlog > 0)
     {
-        blockSum += micReadBuffer_[i];
+        log_w("Frame loss. %u I2S buffers were waiting", backlog);
+        stageProfiler.countDroppedFrame();
     }
 
-    // Compute average value for the current sample block
-    int16_t blockAvg = blockSum / kFFT_SampleCount;
-
-    /*
-    // Increment factor for test signal frequency
-    if ( slotNr_ == 0 )
-    {
-        testSignalFreqFactor_ += 1;
-
-        if ( testSignalFreqFactor_ > kFFT_FreqBinCount )
-        {
-            testSignalFreqFactor_ = 1;
-        }
-    }
-    */
+    log_v("Read duration [µs]: %d. Duration since last read [µs]: %d", timeInRead, timeBetweenRead);
 
-    // Initialize fft input data
-    for (uint16_t i = 0; i < kFFT_SampleCount; i++)
-    {
-        // Corrected input value: Subtract the block average from each sample in order remove the DC component
-        int16_t v = micReadBuffer_[i] - blockAvg;
+    uint32_t probeTime = stageProfiler.now();
 
-        // Constant for normalizing int16 input values to floating point range -1.0 to 1.0
-        const fftData_t kInt16MaxInv = 1.0f / __INT16_MAX__;
+    // Only the last chunk is left, the others were conditioned while waiting for i2s
+    conditionChunk(sampleCount - kI2S_BufferSizeSamples, block);
 
-        // Input value in floating point representation
-        fftData_t r;
+    // DC offset for the next block
+    dcOffset_ = block.sum / sampleCount;
 
-        // Compute input value for FFT
-        r = kInt16MaxInv * v;
+    // Switch to idle mode after this block if the room has been silent for a while
+    float blockRms = sqrtf((float)block.sumSquares / sampleCount);
+    bool isSilent = silenceDetector_.update(blockRms, sampleCount, millis());
 
-        /*
-        // Generate test signal
-        const float k2Pi = 6.2831853f;
-        const float k2PiSampleCountInv = k2Pi * kFFT_SampleCountInv;
+    analysisFrame_.rms = blockRms / __INT16_MAX__;
+    analysisFrame_.peak = (float)block.peak / __INT16_MAX__;
 
-        r = sinf( k2PiSampleCountInv * (testSignalFreqFactor_ * i) );
-        */
+    probeTime = stageProfiler.record(Stage::Conditioning, probeTime, conditionTicks);
 
-        // Store value in FFT input array
-        fftDataReal_[i] = r;
-        fftDataImag_[i] = 0.0f;
-    }
+    // fftMode_.plan->windowing(FFTWindow::Hamming, FFTDirection::Forward);
+    fftMode_.plan->compute(FFTDirection::Forward);
 
-    // fft_.windowing(FFTWindow::Hamming, FFTDirection::Forward);
-    fft_.compute(FFTDirection::Forward);
+    probeTime = stageProfiler.record(Stage::FFT, probeTime);
 
-    fftData_t magnitudeSum = 0;
+    spectrumFeatures_.begin();
 
     // Compute magnitude value for each frequency bin, i.e. only first half of the FFT results
-    for (uint16_t i = 0; i < kFFT_FreqBinCount; i++)
+    for (uint16_t i = 0; i < fftMode_.freqBinCount; i++)
     {
         float magValNew = sqrtf(fftDataReal_[i] * fftDataReal_[i] + fftDataImag_[i] * fftDataImag_[i]);
 
@@ -400,35 +689,39 @@ void FFTProcessor::loop()
         const float w1 = 16.0f / 128.0f;
         const float w2 = 1 - w1;
 
+        float magAvgOld = magnitudeSpectrumAvg_[i];
+
         // Compute low pass filtered magnitude for each frequency bin
-        magnitudeSpectrumAvg_[i] = magValNew * w1 + magnitudeSpectrumAvg_[i] * w2;
+        magnitudeSpectrumAvg_[i] = magValNew * w1 + magAvgOld * w2;
 
-        // Compute overall sum of all (low pass filtered) frequency bins
-        magnitudeSum += magnitudeSpectrumAvg_[i];
+        // Sum, centroid, flux, rolloff and flatness of the (low pass filtered) frequency bins
+        spectrumFeatures_.add(magnitudeSpectrumAvg_[i], magValNew - magAvgOld);
+
+        chromagram_.add(i, magnitudeSpectrumAvg_[i]);
     }
 
-    // Compute magnitude for each frequency band as maximum over all contained frequency bins
-    float magnitudeBand[kFreqBandCount] = {0.0f};
+    spectrumFeatures_.finish(analysisFrame_, fftMode_.freqStep);
+    chromagram_.update();
+
+    fftData_t magnitudeSum = spectrumFeatures_.sum();
+
+    probeTime = stageProfiler.record(Stage::Spectrum, probeTime);
+
+    // Band table for this frame, a table published meanwhile is used from the next frame on.
+    // The swap count is read first, so the acquired table is at least as new as the count.
+    uint32_t bandSwapCount = bandTables_.swapCount();
+    const BandTable &bands = bandTables_.acquire();
+
+    // Compute magnitude for each frequency band with its triangular filter
+    float magnitudeBand[kFreqBandCount];
 
     float magnitudeBandWeightedMax = 0.0f;
 
     for (uint8_t bandIdx = 0; bandIdx < kFreqBandCount; bandIdx++)
     {
-        // Interate over all frequency bins assigned to the frequency band
-        for (uint16_t binIdx = freqBandBinIdxStart_[bandIdx]; binIdx <= freqBandBinIdxEnd_[bandIdx]; binIdx++)
-        {
-            // Apply maximum norm to the frequency bins of each frequency band
-            if (magnitudeSpectrumAvg_[binIdx] > magnitudeBand[bandIdx])
-                magnitudeBand[bandIdx] = magnitudeSpectrumAvg_[binIdx];
-        }
+        magnitudeBand[bandIdx] = bands.magnitude(bandIdx, magnitudeSpectrumAvg_);
 
-        float magnitudeBandWeighted = magnitudeBand[bandIdx] * kFreqBandAmp[bandIdx];
-
-        // Compute maximum magnitude value for each frequency band
-        if (magnitudeBand[bandIdx] > magnitudeBandMax_[bandIdx])
-        {
-            magnitudeBandMax_[bandIdx] = magnitudeBand[bandIdx];
-        }
+        float magnitudeBandWeighted = magnitudeBand[bandIdx] * bands.gain[bandIdx];
 
         // Compute maximum magnitude value across all frequency bands
         if (magnitudeBandWeighted > magnitudeBandWeightedMax)
@@ -436,130 +729,240 @@ void FFTProcessor::loop()
             magnitudeBandWeightedMax = magnitudeBandWeighted;
         }
 
-        lightness[bandIdx] = min(int(magnitudeBandWeighted * sensitivityFactor_), 255);
+        analysisFrame_.lightness[bandIdx] = min(int(magnitudeBandWeighted * sensitivityFactor_), 255);
     }
 
     // Update the sensitivity factor
     const float s1 = 8.0f / 1024.0f;
     const float s2 = 1.0f - s1;
-    sensitivityFactor_ = min((250.0f / magnitudeBandWeightedMax) * s1 + sensitivityFactor_ * s2, kSensitivityFactorMax);
+    sensitivityFactor_ = min((250.0f / magnitudeBandWeightedMax) * s1 + sensitivityFactor_ * s2, sensitivityFactorMax_);
+
+    probeTime = stageProfiler.record(Stage::Bands, probeTime);
 
     // ----- Beat detection -----
 
     // Maintain history of last three magnitude values of the bass band
     beatHist_[0] = beatHist_[1];
     beatHist_[1] = beatHist_[2];
-    beatHist_[2] = magnitudeBand[kBeatDetectBand] * kFreqBandAmp[kBeatDetectBand] * sensitivityFactor_;
+    beatHist_[2] = magnitudeBand[kBeatDetectBand] * bands.gain[kBeatDetectBand] * sensitivityFactor_;
 
     float diff1 = beatHist_[1] - beatHist_[0];
     float diff2 = beatHist_[2] - beatHist_[1];
 
     // Detect magnitude peak
-    isBeatHit = (((diff1 >= kBeatThreshold) && (diff2 < 0)) || ((diff1 > 0) && (diff2 <= -kBeatThreshold)));
+    isBeatHit = (((diff1 >= beatThreshold_) && (diff2 < 0)) || ((diff1 > 0) && (diff2 <= -beatThreshold_)));
 
-    // Determine current consumption from USB
-    float vBusCurrent = M5.Axp.GetVBusCurrent();
+    stageProfiler.record(Stage::Beat, probeTime);
+
+    analysisFrame_.timestamp = timeAferReadMicros;
+    analysisFrame_.sequence++;
+    analysisFrame_.isBeatHit = isBeatHit;
+    analysisFrame_.sensitivity = sensitivityFactor_;
+
+    // Determine current consumption
+    readCurrent();
 
-    if (vBusCurrent > maxCurrent_)
+    // Show current consumption on display
+    if (cycleNr_ == 1 && isDisplayEnabled_ && !isDisplaySuspended_)
     {
-        maxCurrent_ = vBusCurrent;
+        showCurrent();
     }
 
-    // Determine current consumption from battery
-    float batCurrent = 0.5f * M5.Axp.GetIdischargeData();
-
-    if (batCurrent > maxCurrent_)
+    // Stream the analysis result as binary telemetry frame
+    if (telemetry.isEnabled())
     {
-        maxCurrent_ = batCurrent;
+        // Gains when the band table changed and now and then, so a capture started later has them too
+        if (bandSwapCount != telemetrySwapCount_ || ++telemetryGainFrames_ >= kTelemetryGainInterval)
+        {
+            telemetry.publishGains(bands.gain, kFreqBandCount);
+            telemetrySwapCount_ = bandSwapCount;
+            telemetryGainFrames_ = 0;
+        }
+
+        uint32_t stageMicros[(uint8_t)Stage::Count];
+
+        for (uint8_t i = 0; i < (uint8_t)Stage::Count; i++)
+        {
+            stageMicros[i] = stageProfiler.histogram((Stage)i).last();
+        }
+
+        TelemetryFrame frame = {(uint32_t)timeAferReadMicros, sensitivityFactor_, magnitudeSum, isBeatHit,
+                                kFreqBandCount, analysisFrame_.lightness, (uint8_t)Stage::Count, stageMicros};
+        telemetry.publish(frame);
     }
 
-    // Show current consumption on display
-    if (cycleNr_ == 1)
+    // Last use of the band table in this frame
+    bandTables_.release();
+
+    cycleNr_ = (cycleNr_ + 1) % 20;
+
+    if (isSilent)
     {
-        M5.Lcd.setCursor(5, 80);
-        M5.Lcd.setTextSize(2);
-        M5.Lcd.setTextColor(WHITE, BLACK);
-        M5.Lcd.printf("%03.0f mA", maxCurrent_);
-        maxCurrent_ = 0;
+        setIdle(true);
     }
+}
+
+const AnalysisFrame &FFTProcessor::getFrame()
+{
+    return analysisFrame_;
+}
 
-    // If user presses ButtonA, print the current frequency spectrum to serial
-    M5.BtnA.read();
+const Chromagram &FFTProcessor::getChroma()
+{
+    return chromagram_;
+}
 
-    // Compute duration of processing
-    unsigned long timeEndMicros = micros();
-    unsigned long timeDeltaMicros = timeEndMicros - timeStartMicros;
+bool FFTProcessor::setBands(const float *endHz, const float *gain)
+{
+    return bandTables_.update(endHz, gain);
+}
+
+bool FFTProcessor::setBandGains(const float *gain)
+{
+    return bandTables_.updateGains(gain);
+}
 
-    if (userTrigger_ == 0)
+void FFTProcessor::setFftSize(uint8_t sampleCountLog2)
+{
+    if (sampleCountLog2 < kFFT_MinSampleCountLog2 || sampleCountLog2 > kFFT_MaxSampleCountLog2)
     {
-        if (M5.BtnA.isPressed())
-        {
-            userTrigger_ = 5;
-        }
+        log_w("Unsupported FFT size 2^%d", sampleCountLog2);
+        return;
     }
-    else
+
+    preferredSampleCountLog2_ = sampleCountLog2;
+    requestedSampleCountLog2_ = min(sampleCountLog2 + (isBlockSizeBoosted_ ? 1 : 0), (int)kFFT_MaxSampleCountLog2);
+}
+
+uint8_t FFTProcessor::getFftSize()
+{
+    return preferredSampleCountLog2_;
+}
+
+void FFTProcessor::setBlockSizeBoost(bool boosted)
+{
+    isBlockSizeBoosted_ = boosted;
+    setFftSize(preferredSampleCountLog2_);
+}
+
+void FFTProcessor::setDisplaySuspended(bool suspended)
+{
+    isDisplaySuspended_ = suspended;
+}
+
+uint8_t FFTProcessor::getQueuedBuffers()
+{
+    return queuedBuffers_;
+}
+
+/*
+    Serial command 'f'. Resolution and block latency follow from the size; the
+    transform time is measured. Reference, the radix-2 transform of arduinoFFT
+    and the magnitudes timed the same way on an x86 host (-O2, 2000 runs):
+
+    FFT size  resolution  block latency  host transform + magnitudes
+         512    86.1 Hz        11.6 ms     11.7 us
+        1024    43.1 Hz        23.2 ms     23.8 us
+        2048    21.5 Hz        46.4 ms     49.4 us
+        4096    10.8 Hz        92.9 ms    110.5 us
+
+    The time grows about with N log2 N. The device is slower by a large factor
+    that the host cannot tell, so take the device figures from the command.
+*/
+void FFTProcessor::printFftBenchmark()
+{
+    const uint8_t kRuns = 4;
+    const float kToneHz = 1000.0f;
+
+    Serial.println("FFT size  resolution  block latency  transform + magnitudes");
+
+    for (uint8_t log2 = kFFT_MinSampleCountLog2; log2 <= kFFT_MaxSampleCountLog2; log2++)
     {
-        if (userTrigger_ == 1)
+        FftMode mode = makeFftMode(log2);
+        uint32_t totalMicros = 0;
+        float magnitudeSum = 0.0f;
+
+        for (uint8_t run = 0; run < kRuns; run++)
         {
-            Serial.printf("AXP192: VBus current: %.3f mA\n", M5.Axp.GetVBusCurrent());
-            // Serial.printf("FastLed Brightness: %d %%\n", FastLED.getBrightness());
+            // The transform works in place, so the test tone is regenerated for each run
+            for (uint16_t i = 0; i < mode.sampleCount; i++)
+            {
+                fftDataReal_[i] = sinf(2.0f * PI * kToneHz * i / kFFT_SamplingFreq);
+                fftDataImag_[i] = 0.0f;
+            }
 
-            Serial.printf("Processing time: %d\n", timeDeltaMicros);
-            Serial.printf("Sensitivity: %.1f\n", sensitivityFactor_);
+            unsigned long startMicros = micros();
 
-            for (uint8_t i = 0; i < kFreqBandCount; i++)
+            mode.plan->compute(FFTDirection::Forward);
+
+            for (uint16_t i = 0; i < mode.freqBinCount; i++)
             {
-                Serial.printf("%i: to %.0f Hz: %.2f (Max: %.2f) %i\n", i, kFreqBandEndHz[i], magnitudeBand[i], magnitudeBandMax_[i], lightness[i]);
+                magnitudeSum += sqrtf(fftDataReal_[i] * fftDataReal_[i] + fftDataImag_[i] * fftDataImag_[i]);
             }
+
+            totalMicros += micros() - startMicros;
         }
-        userTrigger_ -= 1;
-    }
 
-    float nf;
+        float blockMillis = 1000.0f * mode.sampleCount / kSampleRate;
+        uint32_t transformMicros = totalMicros / kRuns;
 
-    if (fabs(magnitudeBand[1]) < 0.001f)
-    {
-        nf = 1.0f;
-    }
-    else
-    {
-        nf = 1.0f / magnitudeBand[1];
+        Serial.printf("%8u  %7.1f Hz  %10.1f ms  %8u us (%.1f %% of the block)%s\n",
+                      mode.sampleCount, mode.freqStep, blockMillis, transformMicros,
+                      transformMicros / (10.0f * blockMillis), (log2 == fftMode_.sampleCountLog2) ? " *" : "");
     }
 
-    log_v("0:%04.2f 1:%04.2f 2:%04.2f 3:%04.2f 4:%04.2f 5:%04.2f 6:%04.2f 7:%04.2f 8:%04.2f 9:%04.2f 10:%04.2f 11:%04.2f 12:%04.2f 13:%04.2f 14:%04.2f 15:%04.2f 16:%04.2f 17:%04.2f 18:%04.2f 19:%04.2f Sum:%05.1f Sens: %04.1f t: %d",
-          magnitudeBand[0] * nf,
-          magnitudeBand[1] * nf,
-          magnitudeBand[2] * nf,
-          magnitudeBand[3] * nf,
-          magnitudeBand[4] * nf,
-          magnitudeBand[5] * nf,
-          magnitudeBand[6] * nf,
-          magnitudeBand[7] * nf,
-          magnitudeBand[8] * nf,
-          magnitudeBand[9] * nf,
-          magnitudeBand[10] * nf,
-          magnitudeBand[11] * nf,
-          magnitudeBand[12] * nf,
-          magnitudeBand[13] * nf,
-          magnitudeBand[14] * nf,
-          magnitudeBand[15] * nf,
-          magnitudeBand[16] * nf,
-          magnitudeBand[17] * nf,
-          magnitudeBand[18] * nf,
-          magnitudeBand[19] * nf,
-          magnitudeSum,
-          sensitivityFactor_,
-          timeDeltaMicros);
+    // The benchmark holds up the analysis, the next block reports the missed buffers
+    Serial.println("* active size");
+}
 
-    cycleNr_ = (cycleNr_ + 1) % 20;
+void FFTProcessor::applyPreset(const Preset &preset)
+{
+    bandTables_.updateGains(preset.bandGain);
+    beatThreshold_ = preset.beatThreshold;
+    sensitivityFactorMax_ = preset.sensitivityMax;
+
+    if (preset.fftSizeLog2 != 0)
+        setFftSize(preset.fftSizeLog2);
+}
+
+void FFTProcessor::capturePreset(Preset &preset)
+{
+    memcpy(preset.bandGain, bandTables_.current().gain, sizeof(preset.bandGain));
+    preset.beatThreshold = beatThreshold_;
+    preset.sensitivityMax = sensitivityFactorMax_;
+    preset.fftSizeLog2 = preferredSampleCountLog2_;
+}
+
+float FFTProcessor::getCurrent()
+{
+    return lastCurrent_;
+}
+
+void FFTProcessor::setDisplayEnabled(bool enabled)
+{
+    isDisplayEnabled_ = enabled;
+}
+
+bool FFTProcessor::isDisplayEnabled()
+{
+    return isDisplayEnabled_;
 }
 
-int *FFTProcessor::getLightness()
+bool FFTProcessor::isIdle()
 {
-    return lightness;
+    return isIdle_;
 }
 
-bool FFTProcessor::getBeatHit()
+void FFTProcessor::printPowerReport()
 {
-    return isBeatHit;
+    const char *kModeNames[2] = {"active", "idle"};
+
+    for (uint8_t idle = 0; idle < 2; idle++)
+    {
+        Serial.printf("Current %s: %.0f mA average over %u readings\n", kModeNames[idle],
+                      currentCount_[idle] ? currentSum_[idle] / currentCount_[idle] : 0.0f, currentCount_[idle]);
+    }
+
+    Serial.printf("Noise floor: %.1f, silence threshold: %.1f, %s\n",
+                  silenceDetector_.noiseFloor(), silenceDetector_.threshold(), isIdle_ ? "idle" : "active");
 }
\ No newline at end of file
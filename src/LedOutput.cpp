@@ -0,0 +1,90 @@
+#include "LedOutput.h"
+
+/* ----- WS2812 timing ----- */
+const uint32_t kNanosPerLed = 30000; // 24 bits at 800 kHz
+const uint32_t kResetMicros = 300;
+
+// FastLED needs the data pin as template argument, so every usable pin gets its own instantiation
+static bool addController(uint8_t pin, CRGB *leds, uint16_t length)
+{
+    switch (pin)
+    {
+    case 25:
+        FastLED.addLeds<NEOPIXEL, 25>(leds, length);
+        return true;
+    case 26:
+        FastLED.addLeds<NEOPIXEL, 26>(leds, length);
+        return true;
+    case 32:
+        FastLED.addLeds<NEOPIXEL, 32>(leds, length);
+        return true;
+    case 33:
+        FastLED.addLeds<NEOPIXEL, 33>(leds, length);
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool LedOutput::addSegment(const LedSegment &segment, CRGB *frameBuffer, uint16_t frameBufferSize)
+{
+    if (segmentCount_ >= kMaxSegments)
+    {
+        log_e("Too many LED segments. Maximum is %d", kMaxSegments);
+        return false;
+    }
+
+    if (segment.length == 0 || segment.offset + segment.length > frameBufferSize)
+    {
+        log_e("LED segment on pin %d exceeds the frame buffer", segment.pin);
+        return false;
+    }
+
+    for (uint8_t i = 0; i < segmentCount_; i++)
+    {
+        // Two RMT channels on one GPIO would garble both data streams
+        if (pins_[i] == segment.pin)
+        {
+            log_e("Pin %d already drives LED segment %d", segment.pin, i);
+            return false;
+        }
+    }
+
+    if (!addController(segment.pin, frameBuffer + segment.offset, segment.length))
+    {
+        log_e("Pin %d is not available for LED output", segment.pin);
+        return false;
+    }
+
+    pins_[segmentCount_++] = segment.pin;
+
+    if (segment.length > longestSegment_)
+    {
+        longestSegment_ = segment.length;
+    }
+
+    log_d("LED segment %d: pin %d, %d LEDs at offset %d%s", segmentCount_ - 1,
+          segment.pin, segment.length, segment.offset, segment.reversed ? ", reversed" : "");
+
+    return true;
+}
+
+uint32_t LedOutput::expectedShowMicros() const
+{
+    return (longestSegment_ * kNanosPerLed) / 1000 + kResetMicros;
+}
+
+void LedOutput::show()
+{
+    unsigned long timeStartMicros = micros();
+
+    // All segments are clocked out in parallel, one RMT channel each
+    FastLED.show();
+
+    lastShowMicros = micros() - timeStartMicros;
+
+    if (lastShowMicros > maxShowMicros)
+    {
+        maxShowMicros = lastShowMicros;
+    }
+}
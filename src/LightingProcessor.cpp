@@ -1,37 +1,21 @@
 #include "LightingProcessor.h"
+#include "Effects.h"
+#include "LedOutput.h"
+#include "OutputCorrection.h"
+#include "PowerLimiter.h"
+#include "StageProfiler.h"
+#include "StripLayout.h"
 
 /* ----- From FFTProcessor ----- */
 const uint8_t kFreqBandCount = 64;
 
 /* ----- Fastled constants ----- */
 const uint8_t kPinLedStrip = 26; //32; // M5StickC grove port, white cable
-const uint8_t kNumLeds = 139;
+const uint16_t kNumLeds = 139; // Size of the frame buffer shared by all segments
 const uint8_t kLedStripBrightness = 255;
+const uint8_t kSupplyVolts = 12;
 const uint32_t kMaxMilliamps = 9000;
-
-const uint8_t numFreqLeds = floor(kNumLeds / 2 / (kFreqBandCount + 1));                     // (139 / 2) = (69.5 / 21) = 3
-const uint8_t numBassLeds = floor(kNumLeds / 2) - kFreqBandCount * numFreqLeds;             // (139 / 2) = (69.5) - (20 * 3) = 9
-const uint8_t numExtraLeds = kNumLeds - ((kFreqBandCount * numFreqLeds + numBassLeds) * 2); // 139 - (20 * 3 + 9) = 69 * 2 = 138 = 1
-
-enum PrimaryDisplays
-{
-    Default,
-    TwoTone,
-    Solid,
-    Off
-};
-
-enum DisplayModifiers
-{
-    None,
-    Sparkle
-};
-
-uint8_t displayPrimary = PrimaryDisplays::Off;
-uint8_t displayPrimaryAttribute1 = 0; // to be interpreted by primary display
-uint8_t displayPrimaryAttribute2 = 0; 
-uint8_t displayPrimaryAttribute3 = 0; 
-uint8_t displayModifier = DisplayModifiers::None;
+const bool kCalibratePowerFromAxp = false; // Only if the strip is powered through the USB input of the stick
 
 /* ----- Fastled variables -----
 0   = Red
@@ -44,38 +28,201 @@ uint8_t displayModifier = DisplayModifiers::None;
 212 = Purple
 234 = Pink
 */
-// LED strip controller
+
+/* ----- LED segments -----
+Each segment is a strip on its own data pin with its own effect. Segments
+occupy disjoint ranges of the frame buffer.
+*/
+const LedSegment kSegments[] = {
+    // pin, length, offset, reversed, effect, matrix width, matrix wiring
+    {kPinLedStrip, kNumLeds, 0, false, EffectId::Off, 0, MatrixWiring::Progressive},
+    // 32x8 panel on the other grove pin, needs kNumLeds = 139 + 256:
+    // {32, 256, 139, false, EffectId::Waterfall, 32, MatrixWiring::Serpentine},
+};
+const uint8_t kSegmentCount = sizeof(kSegments) / sizeof(kSegments[0]);
+
+static_assert(kSegmentCount <= LedOutput::kMaxSegments, "Too many LED segments");
+
+struct SegmentState
+{
+    StripLayout layout;  // Precomputed assignment of LEDs to bass indicator and frequency bands
+    MatrixLayout matrix; // Pixel grid, only built for matrix segments
+    EffectEngine engine; // Effects and modifiers
+
+    const MatrixLayout *matrixOrNull() const { return matrix.isValid() ? &matrix : nullptr; }
+};
+
+// Frame buffer of all segments, the second one used while crossfading, and the corrected one sent to the LEDs
 CRGB ledStrip_[kNumLeds];
-uint8_t ledStripH[kNumLeds];
-uint8_t ledStripS[kNumLeds];
-uint8_t ledStripV[kNumLeds];
+CRGB ledStripFade_[kNumLeds];
+CRGB ledStripOut_[kNumLeds];
+uint8_t ditherError_[3 * kNumLeds];
+LedMapEntry ledMap_[kNumLeds];
+uint16_t matrixMap_[kNumLeds];
+
+SegmentState segments_[kSegmentCount];
+LedOutput ledOutput_;
+PowerMeter powerMeter_;
+PowerLimiter powerLimiter_;
+OutputCorrection outputCorrection_;
+
+// Frame interval of the idle animation
+const uint32_t kIdleFrameMillis = 100;
+unsigned long idleFrameMillis_ = 0;
+
+// Overload: only every n-th analysed frame is rendered
+uint8_t frameDivider_ = 1;
+uint8_t frameCounter_ = 0;
 
-uint8_t kBassHue = 160; // Blueish
 uint8_t beatVisIntensity_ = 0;
 uint8_t beatCounter = 0;
 uint8_t beatModifier = 0;
-int *freqBinLightness;
 
-// Normal color cycling
-uint8_t colorStart = 30; // Orange-Yellow
-uint8_t colorEnd = 255; // 210;  // Purple
-uint8_t colorStep = floor((colorEnd - colorStart) / (numFreqLeds * kFreqBandCount));
+// Parse a VU parameter of a BLE command, logs and returns false if it is not within minValue..255
+static bool parseVuParameter(const String &text, const char *name, long minValue, uint8_t &value)
+{
+    long parsed = text.toInt();
+
+    if (parsed < minValue || parsed > UINT8_MAX)
+    {
+        log_w("VU %s %ld out of range %ld..255, command ignored.", name, parsed, minValue);
+        return false;
+    }
+
+    value = parsed;
+    return true;
+}
+
+static void applyMode(EffectEngine &engine, const String &mode, bool isMatrix)
+{
+    TwoToneSoundFx &twoTone = engine.effect<EffectId::TwoTone>();
+    DefaultSoundFx &defaultFx = engine.effect<EffectId::Default>();
+
+    if (mode == "default")
+    {
+        engine.select(EffectId::Default, PaletteId::Rainbow);
+    }
+    else if (mode == "christmas")
+    {
+        twoTone.bassHue = 160; // Blueish
+        twoTone.colorStep = 1;
+        engine.select(EffectId::TwoTone, PaletteId::Christmas);
+    }
+    else if (mode == "barbie")
+    {
+        twoTone.bassHue = 175; //
+        twoTone.colorStep = 1;
+        engine.select(EffectId::TwoTone, PaletteId::Barbie);
+    }
+    else if (mode == "usa")
+    {
+        twoTone.bassHue = 160; // Blueish
+        twoTone.colorStep = 1;
+        engine.select(EffectId::TwoTone, PaletteId::Usa);
+    }
+    else if (mode == "waterfall")
+    {
+        // Strips keep their effect
+        if (isMatrix)
+            engine.select(EffectId::Waterfall, PaletteId::Rainbow);
+    }
+    else if (mode == "sparkle")
+        engine.toggleModifier(ModifierId::Sparkle);
+    else if (mode == "pitch")
+        defaultFx.followPitch = !defaultFx.followPitch;
+    else if (mode == "vu")
+        engine.setDynamics(engine.activeEffect, !engine.hasDynamics(engine.activeEffect));
+    else if (mode.indexOf(',') >= 0)
+    {
+        String key = mode.substring(0, mode.indexOf(' '));
+        key.trim();
+        String remainingValues = mode.substring(mode.indexOf(' ') + 1);
 
-// 2-tone mode
-uint8_t colorOneStart = 250; // Red
-uint8_t saturationOne = 255; // 100%
-uint8_t colorTwoStart = 80;  // Green
-uint8_t saturationTwo = 255; // 100%
+        String dpa1 = remainingValues.substring(0, remainingValues.indexOf(','));
+        dpa1.trim();
 
-/* ------ Sparkle Vars ------ */
-uint8_t sparkle_delay[1];
-uint8_t sparkle_step[1];
-uint8_t sparkle_led[1];
-uint8_t sparkle_hue[1];
-uint8_t sparkle_saturation[1];
-uint8_t sparkle_brightness[1];
+        remainingValues = remainingValues.substring(remainingValues.indexOf(',') + 1);
+        String dpa2 = remainingValues.substring(0, remainingValues.indexOf(','));
+        dpa2.trim();
 
-uint8_t userTriggerB_ = 0;
+        String dpa3 = remainingValues.substring(remainingValues.indexOf(',') + 1);
+        dpa3.trim();
+
+        if (key == "vu")
+        {
+            // Release, hold frames and gravity, applied to the active effect. A release or gravity
+            // of 0 would freeze the level or the peak, larger values than 255 would wrap
+            uint8_t release, holdFrames, gravity;
+
+            if (parseVuParameter(dpa1, "release", 1, release) && parseVuParameter(dpa2, "hold", 0, holdFrames) &&
+                parseVuParameter(dpa3, "gravity", 1, gravity))
+            {
+                engine.dynamics.release = release;
+                engine.dynamics.holdFrames = holdFrames;
+                engine.dynamics.gravity = gravity;
+                engine.setDynamics(engine.activeEffect, true);
+            }
+        }
+        else if (key == "solid")
+        {
+            SolidFx &solid = engine.effect<EffectId::Solid>();
+            solid.hue = dpa1.toInt();
+            solid.saturation = dpa2.toInt();
+            solid.brightness = dpa3.toInt();
+            engine.select(EffectId::Solid);
+        }
+    }
+    else if (mode == "black")
+    {
+        engine.select(EffectId::Off);
+    }
+
+    Serial.printf("Mode = %s, Palette = %s, Modifiers = %x, VU = %x\n",
+                  engine.effects.name((uint8_t)engine.activeEffect), paletteName(engine.activePalette()),
+                  engine.activeModifiers, engine.dynamicEffects);
+}
+
+// Update mode if new mode signal received
+static void applyModeToSegments(const String &modifier)
+{
+    if (modifier.isEmpty())
+        return;
+
+    String mode = modifier;
+    mode.toLowerCase();
+
+    // Output correction is shared by all segments
+    if (mode == "gamma")
+    {
+        outputCorrection_.setGamma(outputCorrection_.gamma() == 1.0f ? OutputCorrection::kDefaultGamma : 1.0f);
+        Serial.printf("Gamma = %.1f, Dithering = %d\n", outputCorrection_.gamma(), outputCorrection_.isDithering);
+        return;
+    }
+    else if (mode == "dither")
+    {
+        outputCorrection_.isDithering = !outputCorrection_.isDithering;
+        Serial.printf("Gamma = %.1f, Dithering = %d\n", outputCorrection_.gamma(), outputCorrection_.isDithering);
+        return;
+    }
+
+    for (uint8_t i = 0; i < kSegmentCount; i++)
+    {
+        applyMode(segments_[i].engine, mode, segments_[i].matrix.isValid());
+    }
+}
+
+// Limit the brightness to the power budget, using the load summed up while rendering, in the output pass.
+// The load is counted at the gamma corrected levels, see PowerMeter::setLevels().
+static void correctFrame()
+{
+    outputCorrection_.apply(ledStrip_, ledStripOut_, powerLimiter_.update(powerMeter_.load()));
+}
+
+static void showFrame()
+{
+    correctFrame();
+    ledOutput_.show();
+}
 
 LightingProcessor::LightingProcessor()
 {
@@ -84,25 +231,55 @@ LightingProcessor::LightingProcessor()
 
 void LightingProcessor::setupLedStrip()
 {
-    delay(500);
-    FastLED.addLeds<NEOPIXEL, kPinLedStrip>(ledStrip_, kNumLeds);
+    for (uint8_t i = 0; i < kSegmentCount; i++)
+    {
+        const LedSegment &segment = kSegments[i];
+
+        if (!ledOutput_.addSegment(segment, ledStripOut_, kNumLeds))
+        {
+            continue;
+        }
+
+        segments_[i].layout.build(ledMap_ + segment.offset, segment.length, kFreqBandCount, segment.reversed);
+
+        if (segment.matrixWidth > 0)
+        {
+            if (segment.length % segment.matrixWidth != 0 ||
+                !segments_[i].matrix.build(matrixMap_ + segment.offset, segment.matrixWidth,
+                                           segment.length / segment.matrixWidth, segment.wiring, false, segment.reversed))
+            {
+                log_e("Segment %d does not form a matrix %d pixels wide", i, segment.matrixWidth);
+            }
+        }
+
+        segments_[i].engine.select(segment.effect, PaletteId::Rainbow, 0);
+
+        Serial.printf("Segment %i: %i leds on pin %i, %i bands and %i for bass.\n",
+                      i, segment.length, segment.pin, kFreqBandCount, segments_[i].layout.bassLeds());
+    }
+
+    // The power limit is applied by powerLimiter_ instead of FastLED, see correctFrame()
+    powerLimiter_.masterBrightness = kLedStripBrightness;
+    powerLimiter_.begin(kSupplyVolts, kMaxMilliamps, kNumLeds);
+
+    // Brightness and dithering are part of the output pass, see OutputCorrection
+    outputCorrection_.begin(ditherError_, kNumLeds);
+    powerMeter_.setLevels(outputCorrection_.levels(0), outputCorrection_.levels(1), outputCorrection_.levels(2));
+    FastLED.setBrightness(255);
+    FastLED.setDither(DISABLE_DITHER);
+
     FastLED.clear();
-    FastLED.setBrightness(kLedStripBrightness);
-    FastLED.setMaxPowerInVoltsAndMilliamps(12, kMaxMilliamps); // Set maximum power consumption to 5 V and 2.5 A
     ledStrip_[0].setHSV(60, 255, 255);
-    FastLED.show();
+    outputCorrection_.apply(ledStrip_, ledStripOut_, kLedStripBrightness);
+    ledOutput_.show();
 
-    Serial.printf("Total leds: %i, %i for each band and %i for bass. Color step will be %i. There are %i extras to be distributed.",
-                  kNumLeds, numFreqLeds, numBassLeds, colorStep, numExtraLeds);
+    Serial.printf("Expected refresh time: %u us\n", ledOutput_.expectedShowMicros());
 }
 
-void LightingProcessor::updateLedStrip(int lightness[], bool isBeatHit, String modifier)
+void LightingProcessor::updateLedStrip(const AnalysisFrame &frame, const Chromagram &chroma, String modifier)
 {
-    // Update class frequency bin lightness values
-    freqBinLightness = lightness;
-
     // Detect magnitude peak
-    beatVisIntensity_ = (isBeatHit) ? 250 : (beatVisIntensity_ > 0) ? beatVisIntensity_ -= 25
+    beatVisIntensity_ = (frame.isBeatHit) ? 250 : (beatVisIntensity_ > 0) ? beatVisIntensity_ -= 25
                                                                     : 0;
 
     if (beatVisIntensity_ == 150)
@@ -115,243 +292,172 @@ void LightingProcessor::updateLedStrip(int lightness[], bool isBeatHit, String m
         beatModifier = (beatModifier == 0) ? 1 : 0;
     }
 
-    // Update mode if new mode signal received
-    if (!modifier.isEmpty())
-    {
-        String mode = modifier;
-        mode.toLowerCase();
-
-        if (mode == "default")
-        {
-            uint8_t colorStart = 30; // Orange-Yellow
-            uint8_t colorEnd = 210;  // Purple
-            uint8_t colorStep = floor((colorEnd - colorStart) / (numFreqLeds * kFreqBandCount));
-            displayPrimary = PrimaryDisplays::Default;
-        }
-        else if (mode == "christmas")
-        {
-            colorOneStart = 250; // Red
-            saturationOne = 255; // Full
-            colorTwoStart = 80;  // Green
-            saturationTwo = 255; // Full
-            kBassHue = 160;      // Blueish
-            colorStep = 1;
-            displayPrimary = PrimaryDisplays::TwoTone;
-        }
-        else if (mode == "barbie")
-        {
-            colorOneStart = 200; // Purple
-            saturationOne = 255; // Full
-            colorTwoStart = 234; // Pink
-            saturationTwo = 255; // Full
-            kBassHue = 175;      //
-            colorStep = 1;
-            displayPrimary = PrimaryDisplays::TwoTone;
-        }
-        else if (mode == "usa")
-        {
-            colorOneStart = 250; // Red
-            saturationOne = 255; // Full
-            colorTwoStart = 255;   // Does not matter
-            saturationTwo = 0;   // White
-            kBassHue = 160;      // Blueish
-            colorStep = 1;
-            displayPrimary = PrimaryDisplays::TwoTone;
-        }
-        else if (mode == "sparkle")
-            displayModifier = (displayModifier == DisplayModifiers::Sparkle) ? DisplayModifiers::None : DisplayModifiers::Sparkle;
-        else if (mode.indexOf(',') >= 0)
-        {
-            String key = mode.substring(0, mode.indexOf(' '));
-            key.trim();
-            String remainingValues = mode.substring(mode.indexOf(' ') + 1);
+    applyModeToSegments(modifier);
 
-            String dpa1 = remainingValues.substring(0, remainingValues.indexOf(','));
-            dpa1.trim();
-            displayPrimaryAttribute1 = dpa1.toInt();
+    // The beat state above advances every frame, so skipped frames do not slow it down
+    if (++frameCounter_ < frameDivider_)
+        return;
 
-            remainingValues = remainingValues.substring(remainingValues.indexOf(',') + 1);
-            String dpa2 = remainingValues.substring(0, remainingValues.indexOf(','));
-            dpa2.trim();
-            displayPrimaryAttribute2 = dpa2.toInt();
+    frameCounter_ = 0;
 
-            String dpa3 = remainingValues.substring(remainingValues.indexOf(',') + 1);
-            dpa3.trim();
-            displayPrimaryAttribute3 = dpa3.toInt();
+    uint32_t probeTime = stageProfiler.now();
 
-            if (key == "solid")
-            {
-                displayPrimary = PrimaryDisplays::Solid;
-            }
-        }
-        else if (mode == "black")
-        {
-            displayPrimary = PrimaryDisplays::Off;
-        }
+    powerMeter_.reset();
 
-        Serial.printf("Mode = %i, Modifier = %i, Extra = %i\n", displayPrimary, displayModifier, displayPrimaryAttribute1);
+    for (uint8_t i = 0; i < kSegmentCount; i++)
+    {
+        const LedSegment &segment = kSegments[i];
+        EffectContext ctx = {&segments_[i].layout, segments_[i].matrixOrNull(), nullptr, frame.lightness, nullptr, beatVisIntensity_, beatModifier, &frame, &chroma, &powerMeter_};
+        segments_[i].engine.render(ctx, ledStrip_ + segment.offset, ledStripFade_ + segment.offset);
     }
 
-    if (displayPrimary == PrimaryDisplays::Default)
-        defaultSoundFx();
-    else if (displayPrimary == PrimaryDisplays::TwoTone)
-        twoToneSoundFx();
-    else if (displayPrimary == PrimaryDisplays::Solid)
-        constantFx(displayPrimaryAttribute1, displayPrimaryAttribute2, displayPrimaryAttribute3);
-    else if (displayPrimary == PrimaryDisplays::Off) 
-        constantFx(0, 255, 0);
+    probeTime = stageProfiler.record(Stage::Effects, probeTime);
+
+    correctFrame();
 
-    if (displayModifier == DisplayModifiers::Sparkle)
-        sparkleFx();
+    probeTime = stageProfiler.record(Stage::Output, probeTime);
 
-    FastLED.show();
+    ledOutput_.show();
+
+    stageProfiler.record(Stage::LedShow, probeTime);
 }
 
-void LightingProcessor::defaultSoundFx()
+void LightingProcessor::updateIdle(String modifier)
 {
-    uint8_t ledIndex = 0;
-    uint8_t ledRevIndex = kNumLeds - 1;
+    applyModeToSegments(modifier);
+
+    // Low frame rate, the strip only shows a slow animation
+    if (millis() - idleFrameMillis_ < kIdleFrameMillis)
+        return;
 
-    // Show beat detection at the beginning and end of the strip
-    for (int i = 0; i < numBassLeds; i++)
+    idleFrameMillis_ = millis();
+    beatVisIntensity_ = 0;
+    powerMeter_.reset();
+
+    for (uint8_t i = 0; i < kSegmentCount; i++)
     {
-        setHSV(ledIndex++, kBassHue, 255, beatVisIntensity_);
-        setHSV(ledRevIndex--, kBassHue, 255, beatVisIntensity_);
+        const LedSegment &segment = kSegments[i];
+        EffectContext ctx = {&segments_[i].layout, segments_[i].matrixOrNull(), nullptr, nullptr, nullptr, 0, beatModifier, nullptr, nullptr, &powerMeter_};
+        segments_[i].engine.renderIdle(ctx, ledStrip_ + segment.offset);
     }
 
-    // Show frequency intensities on the remaining Leds
-    uint8_t color = colorStart;
-    for (int k = 0; k < kFreqBandCount; k++)
+    showFrame();
+}
+
+void LightingProcessor::setFrameDivider(uint8_t divider)
+{
+    frameDivider_ = divider ? divider : 1;
+    frameCounter_ = 0;
+}
+
+void LightingProcessor::setModifiersSuspended(bool suspended)
+{
+    for (uint8_t i = 0; i < kSegmentCount; i++)
     {
-        for (int j = 0; j < numFreqLeds; j++)
-        {
-            setHSV(ledIndex++, color, 255, freqBinLightness[k]);
-            setHSV(ledRevIndex--, color, 255, freqBinLightness[k]);
-            color += colorStep;
-        }
+        segments_[i].engine.areModifiersSuspended = suspended;
     }
+}
 
-    // If extra leds are odd, give extra 1 to the last band aka the center band.
-    if (numExtraLeds == 1)
+void LightingProcessor::printEffectStats()
+{
+    for (uint8_t i = 0; i < kSegmentCount; i++)
     {
-        setHSV(ledIndex, color, 255, freqBinLightness[kFreqBandCount - 1]);
+        Serial.printf("Segment %i:\n", i);
+        segments_[i].engine.printStats();
     }
 
-    kBassHue++; // Increment base hue so it slowly changes color
+    Serial.printf("LED show: last %u us, max %u us, expected %u us\n",
+                  ledOutput_.lastShowMicros, ledOutput_.maxShowMicros, ledOutput_.expectedShowMicros());
+
+    Serial.printf("LED power: %u mW estimated, brightness %u, calibration %.2f\n",
+                  powerLimiter_.estimatedMilliwatts(), powerLimiter_.brightness(), powerLimiter_.calibration());
 }
 
-void LightingProcessor::twoToneSoundFx()
+void LightingProcessor::printParticleBenchmark()
 {
-    uint8_t ledIndex = 0;
-    uint8_t ledRevIndex = kNumLeds - 1;
+    const uint16_t kFrames = 200;
 
-    // Show beat detection at the beginning and end of the strip
-    for (int i = 0; i < numBassLeds; i++)
-    {
-        setHSV(ledIndex++, kBassHue, 255, beatVisIntensity_);
-        setHSV(ledRevIndex--, kBassHue, 255, beatVisIntensity_);
-    }
+    // Kept off the loop task stack; renders into the crossfade buffer, which every fade redraws
+    static ParticleSystem particles;
 
-    // Show frequency intensities on the remaining Leds
-    uint8_t color = colorOneStart;
-    uint8_t saturation = saturationOne;
-    for (int k = 0; k < kFreqBandCount; k++)
-    {
-        if (k % 10 == 0)
-        {
-            color = (beatModifier == 0) ? colorOneStart : colorTwoStart;
-            saturation = (beatModifier == 0) ? saturationOne : saturationTwo;
-        }
-        else if (k % 5 == 0)
-        {
-            color = (beatModifier == 0) ? colorTwoStart : colorOneStart;
-            saturation = (beatModifier == 0) ? saturationTwo : saturationOne;
-        }
+    unsigned long startMicros = micros();
+    uint32_t updates = runParticleBenchmark(particles, ledStripFade_, kNumLeds, kFrames);
+    uint32_t elapsedMicros = micros() - startMicros;
 
-        for (int j = 0; j < numFreqLeds; j++)
-        {
-            setHSV(ledIndex++, color, saturation, freqBinLightness[k]);
-            setHSV(ledRevIndex--, color, saturation, freqBinLightness[k]);
-            color += colorStep;
-        }
-    }
+    uint32_t frameMicros = elapsedMicros / kFrames;
 
-    // If extra leds are odd, give extra 1 to the last band aka the center band.
-    if (numExtraLeds == 1)
-    {
-        setHSV(ledIndex, color, 255, freqBinLightness[kFreqBandCount - 1]);
-    }
+    Serial.printf("Particles: %u on %u LEDs, %u us per frame (%.1f %% of the frame budget), %u updates per ms\n",
+                  ParticleSystem::kCapacity, kNumLeds, frameMicros, frameMicros * 100.0f / stageProfiler.frameBudget(),
+                  (uint32_t)((uint64_t)updates * 1000 / max(elapsedMicros, (uint32_t)1)));
 }
 
-void LightingProcessor::sparkleFx()
+void LightingProcessor::applyPreset(const Preset &preset)
 {
-    for (int x = 0; x < sizeof(sparkle_led); x++)
+    if (preset.effect >= (uint8_t)EffectId::Count || preset.palette >= (uint8_t)PaletteId::Count)
     {
-        if (sparkle_delay[x] == 0 && sparkle_step[x] == 0)
-        {
-            srand(time(NULL));
-            uint8_t randStart = rand() % 50;
-            sparkle_delay[x] = randStart + 25;
-            sparkle_led[x] = rand() % (kNumLeds - 2) + 1;
-        }
-        else if (sparkle_delay[x] > 0)
-        {
-            if (--sparkle_delay[x] == 0)
-            {
-                sparkle_step[x] = 1;
-            }
-        }
+        log_e("Invalid preset %s", preset.name);
+        return;
+    }
 
-        switch (sparkle_step[x])
-        {
-        case 0:
-            return;
-        case 1:
-            sparkle_brightness[x] = ledStripV[sparkle_led[x]];
-            sparkle_saturation[x] = 200;
-            sparkle_hue[x] = ledStripH[sparkle_led[x]];
-            ledStrip_[sparkle_led[x]].setHSV(sparkle_hue[x], sparkle_saturation[x], sparkle_brightness[x]);
-            sparkle_step[x]++;
-            break;
-        case 2:
-            sparkle_brightness[x] > 205 ? sparkle_brightness[x] = 255 : sparkle_brightness[x] += 50;
-            sparkle_saturation[x] -= 50;
-            ledStrip_[sparkle_led[x] - 1].setHSV(sparkle_hue[x], sparkle_saturation[x] + 100, sparkle_brightness[x]);
-            ledStrip_[sparkle_led[x]].setHSV(sparkle_hue[x], sparkle_saturation[x], sparkle_brightness[x]);
-            ledStrip_[sparkle_led[x] + 1].setHSV(sparkle_hue[x], sparkle_saturation[x] + 100, sparkle_brightness[x]);
-            if (sparkle_saturation[x] == 0)
-                sparkle_step[x]++;
-            break;
-        case 12:
-            sparkle_brightness[x] -= 20;
-            sparkle_saturation[x] += 5;
-            ledStrip_[sparkle_led[x] - 1].setHSV(sparkle_hue[x], sparkle_saturation[x] + 100, sparkle_brightness[x]);
-            ledStrip_[sparkle_led[x]].setHSV(sparkle_hue[x], sparkle_saturation[x], sparkle_brightness[x]);
-            ledStrip_[sparkle_led[x] + 1].setHSV(sparkle_hue[x], sparkle_saturation[x] + 100, sparkle_brightness[x]);
-            if (sparkle_brightness[x] < 50)
-                sparkle_step[x] = 0;
-            break;
-        default:
-            ledStrip_[sparkle_led[x] - 1].setHSV(sparkle_hue[x], sparkle_saturation[x] + 100, sparkle_brightness[x]);
-            ledStrip_[sparkle_led[x]].setHSV(sparkle_hue[x], sparkle_saturation[x], sparkle_brightness[x]);
-            ledStrip_[sparkle_led[x] + 1].setHSV(sparkle_hue[x], sparkle_saturation[x] + 100, sparkle_brightness[x]);
-            sparkle_step[x]++;
-        }
+    for (uint8_t i = 0; i < kSegmentCount; i++)
+    {
+        EffectEngine &engine = segments_[i].engine;
+
+        TwoToneSoundFx &twoTone = engine.effect<EffectId::TwoTone>();
+        twoTone.bassHue = preset.bassHue;
+        twoTone.colorStep = preset.colorStep;
+
+        DefaultSoundFx &defaultFx = engine.effect<EffectId::Default>();
+        defaultFx.bassHue = preset.bassHue;
+        defaultFx.followPitch = preset.followPitch != 0;
+
+        SolidFx &solid = engine.effect<EffectId::Solid>();
+        solid.hue = preset.solidHue;
+        solid.saturation = preset.solidSaturation;
+        solid.brightness = preset.solidBrightness;
+
+        // A waterfall preset shows the default effect on strips
+        EffectId effect = (EffectId)preset.effect;
+        if (effect == EffectId::Waterfall && !segments_[i].matrix.isValid())
+            effect = EffectId::Default;
+
+        engine.activeModifiers = preset.modifiers;
+        engine.dynamicEffects = preset.dynamicEffects;
+        if (preset.vuRelease != 0)
+            engine.dynamics.release = preset.vuRelease;
+        engine.select(effect, (PaletteId)preset.palette);
     }
+
+    powerLimiter_.masterBrightness = preset.brightness;
+
+    Serial.printf("Preset = %s\n", preset.name);
 }
 
-void LightingProcessor::constantFx(uint8_t val, uint8_t saturation, uint8_t brightness)
+void LightingProcessor::capturePreset(Preset &preset)
 {
-    for (int i = 0; i < kNumLeds; i++)
-    {
-        ledStrip_[i].setHSV(val, saturation, brightness);
-    }
+    EffectEngine &engine = segments_[0].engine;
+
+    TwoToneSoundFx &twoTone = engine.effect<EffectId::TwoTone>();
+    SolidFx &solid = engine.effect<EffectId::Solid>();
+
+    preset.effect = (uint8_t)engine.activeEffect;
+    preset.palette = (uint8_t)engine.activePalette();
+    preset.modifiers = engine.activeModifiers;
+    preset.dynamicEffects = engine.dynamicEffects;
+    preset.vuRelease = engine.dynamics.release;
+    preset.brightness = powerLimiter_.masterBrightness;
+    preset.bassHue = twoTone.bassHue;
+    preset.colorStep = twoTone.colorStep;
+    preset.solidHue = solid.hue;
+    preset.solidSaturation = solid.saturation;
+    preset.solidBrightness = solid.brightness;
+    preset.followPitch = engine.effect<EffectId::Default>().followPitch ? 1 : 0;
 }
 
-void LightingProcessor::setHSV(u_int8_t index, uint8_t H, uint8_t S, uint8_t V)
+void LightingProcessor::addCurrentMeasurement(float milliamps)
 {
-    ledStrip_[index].setHSV(H, S, V);
-    ledStripH[index] = H;
-    ledStripS[index] = S;
-    ledStripV[index] = V;
+    if (kCalibratePowerFromAxp)
+    {
+        powerLimiter_.addMeasurement(milliamps);
+    }
 }
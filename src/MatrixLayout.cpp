@@ -0,0 +1,39 @@
+#include "MatrixLayout.h"
+
+bool MatrixLayout::build(uint16_t *map, uint8_t width, uint8_t height, MatrixWiring wiring, bool isColumnMajor,
+                         bool reversed)
+{
+    if (map == nullptr || width == 0 || height == 0 || width > kMaxWidth || height > kMaxHeight)
+    {
+        log_e("Unsupported matrix layout: %dx%d", width, height);
+        return false;
+    }
+
+    map_ = map;
+    width_ = width;
+    height_ = height;
+
+    uint16_t numLeds = size();
+
+    for (uint8_t y = 0; y < height; y++)
+    {
+        for (uint8_t x = 0; x < width; x++)
+        {
+            // Position along the chain: 'line' is the row or column, 'step' the pixel within it
+            uint8_t line = isColumnMajor ? x : y;
+            uint8_t step = isColumnMajor ? y : x;
+            uint8_t lineLength = isColumnMajor ? height : width;
+
+            if (wiring == MatrixWiring::Serpentine && (line & 1))
+            {
+                step = lineLength - 1 - step;
+            }
+
+            uint16_t ledIdx = line * lineLength + step;
+
+            map_[y * width + x] = reversed ? numLeds - 1 - ledIdx : ledIdx;
+        }
+    }
+
+    return true;
+}
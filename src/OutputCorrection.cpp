@@ -0,0 +1,63 @@
+#include "OutputCorrection.h"
+#include <math.h>
+
+constexpr float OutputCorrection::kDefaultGamma;
+
+bool OutputCorrection::begin(uint8_t *error, uint16_t numLeds)
+{
+    if (error == nullptr || numLeds == 0 || numLeds > kMaxLeds)
+    {
+        log_e("Unsupported output correction for %d LEDs", numLeds);
+        return false;
+    }
+
+    error_ = error;
+    numLeds_ = numLeds;
+    memset(error_, 0, 3 * numLeds);
+
+    setGamma(kDefaultGamma);
+
+    return true;
+}
+
+void OutputCorrection::setGamma(float red, float green, float blue)
+{
+    const float gamma[3] = {red, green, blue};
+
+    for (uint8_t ch = 0; ch < 3; ch++)
+    {
+        gammaValues_[ch] = gamma[ch];
+
+        for (uint16_t v = 0; v < 256; v++)
+        {
+            // 255 maps to 255.0, so full brightness is never dithered
+            gamma_[ch][v] = lroundf(powf(v / 255.0f, gamma[ch]) * (255 << 8));
+        }
+    }
+}
+
+void OutputCorrection::apply(const CRGB *in, CRGB *out, uint8_t brightness)
+{
+    const uint16_t *lut[3] = {gamma_[0], gamma_[1], gamma_[2]};
+    const uint32_t scale = brightness + 1;
+
+    // Without dithering the error is dropped and the level rounded instead
+    const uint8_t errorMask = isDithering ? 0xFF : 0x00;
+    const uint8_t bias = isDithering ? 0x00 : 0x80;
+
+    const uint8_t *src = in[0].raw;
+    uint8_t *dst = out[0].raw;
+    uint8_t *error = error_;
+
+    for (uint16_t i = 0; i < numLeds_; i++)
+    {
+        for (uint8_t ch = 0; ch < 3; ch++)
+        {
+            // At most 255.0 plus an error below 1.0, so the sum never exceeds 16 bits
+            uint32_t level = ((lut[ch][*src++] * scale) >> 8) + ((*error & errorMask) | bias);
+
+            *dst++ = level >> 8;
+            *error++ = level & 0xFF;
+        }
+    }
+}
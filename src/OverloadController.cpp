@@ -0,0 +1,85 @@
+#include "OverloadController.h"
+#include <stdio.h>
+
+const char *OverloadController::levelName(OverloadLevel level)
+{
+    switch (level)
+    {
+    case OverloadLevel::Full:
+        return "full";
+    case OverloadLevel::NoDisplay:
+        return "no display";
+    case OverloadLevel::NoParticles:
+        return "no particles";
+    case OverloadLevel::HalfLedRate:
+        return "half LED rate";
+    case OverloadLevel::LargerBlock:
+        return "larger block";
+    default:
+        return "?";
+    }
+}
+
+void OverloadController::setLevel(OverloadLevel level)
+{
+    left_[(uint8_t)level_]++;
+    entered_[(uint8_t)level]++;
+    level_ = level;
+
+    recentMisses_ = 0;
+    windowFrames_ = 0;
+    calmFrames_ = 0;
+}
+
+bool OverloadController::update(uint32_t frameMicros, uint32_t budgetMicros, uint8_t queuedBuffers)
+{
+    bool isLate = (budgetMicros > 0 && frameMicros > budgetMicros) || queuedBuffers > 0;
+
+    if (isLate)
+    {
+        recentMisses_++;
+        calmFrames_ = 0;
+    }
+    else if ((uint64_t)frameMicros * 100 < (uint64_t)budgetMicros * headroomPercent)
+    {
+        calmFrames_++;
+    }
+    else
+    {
+        // On time but busy: neither step down nor count towards recovery
+        calmFrames_ = 0;
+    }
+
+    if (level_ < maxLevel && (recentMisses_ >= missesToStepDown || queuedBuffers > 1))
+    {
+        setLevel((OverloadLevel)((uint8_t)level_ + 1));
+        return true;
+    }
+
+    if (level_ > OverloadLevel::Full && calmFrames_ >= recoveryFrames)
+    {
+        setLevel((OverloadLevel)((uint8_t)level_ - 1));
+        return true;
+    }
+
+    if (++windowFrames_ >= missWindowFrames)
+    {
+        windowFrames_ = 0;
+        recentMisses_ = 0;
+    }
+
+    return false;
+}
+
+size_t OverloadController::format(char *buffer, size_t size) const
+{
+    size_t length = snprintf(buffer, size, "Overload level: %s\n", levelName(level_));
+
+    for (uint8_t i = 0; i < (uint8_t)OverloadLevel::Count && length < size; i++)
+    {
+        length += snprintf(buffer + length, size - length, "%-14s entered %5u, left %5u\n",
+                           levelName((OverloadLevel)i), (unsigned)entered_[i], (unsigned)left_[i]);
+    }
+
+    return length < size ? length : size - 1;
+}
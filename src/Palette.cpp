@@ -0,0 +1,70 @@
+#include "Palette.h"
+
+/* ----- Rainbow palette ----- */
+const uint8_t kRainbowHueStart = 30; // Orange-Yellow
+const uint8_t kRainbowHueSpan = 225;
+
+/* ----- Gradient definitions: index, red, green, blue ----- */
+DEFINE_GRADIENT_PALETTE(kChristmasGradient){
+    0, 246, 0, 9,    // Red
+    127, 246, 0, 9,  //
+    128, 85, 213, 0, // Green
+    255, 85, 213, 0};
+
+DEFINE_GRADIENT_PALETTE(kBarbieGradient){
+    0, 107, 0, 149,  // Purple
+    127, 107, 0, 149, //
+    128, 198, 0, 57, // Pink
+    255, 198, 0, 57};
+
+DEFINE_GRADIENT_PALETTE(kUsaGradient){
+    0, 246, 0, 9,      // Red
+    127, 246, 0, 9,    //
+    128, 255, 255, 255, // White
+    255, 255, 255, 255};
+
+void compilePalette(PaletteId id, CRGBPalette256 &lut)
+{
+    switch (id)
+    {
+    case PaletteId::Rainbow:
+        for (uint16_t i = 0; i < 256; i++)
+        {
+            hsv2rgb_rainbow(CHSV(kRainbowHueStart + scale8(i, kRainbowHueSpan), 255, 255), lut[i]);
+        }
+        break;
+
+    case PaletteId::Christmas:
+        lut = kChristmasGradient;
+        break;
+
+    case PaletteId::Barbie:
+        lut = kBarbieGradient;
+        break;
+
+    case PaletteId::Usa:
+        lut = kUsaGradient;
+        break;
+
+    default:
+        fill_solid(lut.entries, 256, CRGB::Black);
+        break;
+    }
+}
+
+const char *paletteName(PaletteId id)
+{
+    switch (id)
+    {
+    case PaletteId::Rainbow:
+        return "rainbow";
+    case PaletteId::Christmas:
+        return "christmas";
+    case PaletteId::Barbie:
+        return "barbie";
+    case PaletteId::Usa:
+        return "usa";
+    default:
+        return "?";
+    }
+}
@@ -0,0 +1,84 @@
+#include "Particles.h"
+
+bool ParticleSystem::spawn(int32_t position, int16_t velocity, uint8_t life, uint8_t decay)
+{
+    if (count_ >= kCapacity || life == 0)
+        return false;
+
+    position_[count_] = position;
+    velocity_[count_] = velocity;
+    life_[count_] = life;
+    decay_[count_] = max(decay, (uint8_t)1);
+    count_++;
+
+    return true;
+}
+
+void ParticleSystem::updateAndRender(CRGB *leds, uint16_t numLeds, PowerMeter &power)
+{
+    const int32_t kPositionEnd = (int32_t)numLeds << 8;
+
+    uint16_t i = 0;
+
+    while (i < count_)
+    {
+        int32_t position = position_[i] + velocity_[i];
+
+        // Cull particles that burnt out or left the strip
+        if (life_[i] <= decay_[i] || position < 0 || position >= kPositionEnd)
+        {
+            count_--;
+            position_[i] = position_[count_];
+            velocity_[i] = velocity_[count_];
+            life_[i] = life_[count_];
+            decay_[i] = decay_[count_];
+            continue;
+        }
+
+        position_[i] = position;
+        life_[i] -= decay_[i];
+
+        // Spread the particle over its two neighbouring LEDs according to the sub-LED position
+        uint16_t ledIdx = position >> 8;
+        uint8_t frac = position & 0xFF;
+        uint8_t life = life_[i];
+
+        CRGB before = leds[ledIdx];
+        leds[ledIdx] = blend(before, CRGB(CRGB::White), scale8(life, 255 - frac));
+        power.replace(before, leds[ledIdx]);
+
+        if (ledIdx + 1 < numLeds)
+        {
+            before = leds[ledIdx + 1];
+            leds[ledIdx + 1] = blend(before, CRGB(CRGB::White), scale8(life, frac));
+            power.replace(before, leds[ledIdx + 1]);
+        }
+
+        i++;
+    }
+}
+
+uint32_t runParticleBenchmark(ParticleSystem &particles, CRGB *leds, uint16_t numLeds, uint16_t frames)
+{
+    FastRandom rng;
+    PowerMeter power;
+    uint32_t updates = 0;
+
+    particles.clear();
+
+    for (uint16_t frame = 0; frame < frames; frame++)
+    {
+        // Refill the pool, as a burst of the beat emitter does
+        while (particles.count() < ParticleSystem::kCapacity)
+        {
+            particles.spawn((int32_t)rng.below(numLeds) << 8, (int16_t)rng.below(129) - 64, 255, 1 + rng.below(4));
+        }
+
+        updates += particles.count();
+        particles.updateAndRender(leds, numLeds, power);
+    }
+
+    particles.clear();
+
+    return updates;
+}
@@ -0,0 +1,57 @@
+#include "PowerLimiter.h"
+
+const float kMilliwattsPerLoad = (float)kLedVolts / 255.0f;
+
+// Low pass weight for the calibration and limits of the correction
+const float kCalibrationWeight = 0.05f;
+const float kCalibrationMin = 0.5f;
+const float kCalibrationMax = 2.0f;
+
+void PowerLimiter::begin(uint8_t volts, uint32_t milliamps, uint16_t numLeds)
+{
+    budgetMilliwatts_ = (uint32_t)volts * milliamps;
+    numLeds_ = numLeds;
+    scale_ = masterBrightness;
+}
+
+uint8_t PowerLimiter::update(uint32_t load)
+{
+    float fullMilliwatts = load * kMilliwattsPerLoad * calibration_;
+    float darkMilliwatts = numLeds_ * kLedDarkMilliamps * kLedVolts;
+    float availableMilliwatts = max((float)budgetMilliwatts_ - darkMilliwatts, 0.0f);
+
+    float target = masterBrightness;
+
+    if (fullMilliwatts * target / 255.0f > availableMilliwatts)
+    {
+        target = 255.0f * availableMilliwatts / fullMilliwatts;
+    }
+
+    scale_ += (target - scale_) * ((target < scale_) ? attack : release);
+
+    ledMilliwatts_ = load * kMilliwattsPerLoad * scale_ / 255.0f;
+
+    return brightness();
+}
+
+void PowerLimiter::addMeasurement(float milliamps)
+{
+    float measuredMilliwatts = milliamps * kLedVolts;
+
+    // With all LEDs dark the reading is the draw of everything but the LED colors
+    if (ledMilliwatts_ < 1.0f)
+    {
+        baselineMilliwatts_ += (measuredMilliwatts - baselineMilliwatts_) * kCalibrationWeight;
+        return;
+    }
+
+    float ratio = (measuredMilliwatts - baselineMilliwatts_) / ledMilliwatts_;
+    ratio = constrain(ratio, kCalibrationMin, kCalibrationMax);
+
+    calibration_ += (ratio - calibration_) * kCalibrationWeight;
+}
+
+uint32_t PowerLimiter::estimatedMilliwatts() const
+{
+    return numLeds_ * kLedDarkMilliamps * kLedVolts + ledMilliwatts_ * calibration_;
+}
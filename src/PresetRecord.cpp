@@ -0,0 +1,75 @@
+#include "PresetRecord.h"
+#include "Crc16.h"
+#include <math.h>
+
+static_assert(offsetof(PresetRecord, crc) == 12 + kPresetMaxCount * sizeof(Preset), "No padding in the CRC protected part");
+
+static uint16_t recordCrc(const PresetRecord &record)
+{
+    return crc16Ccitt((const uint8_t *)&record, offsetof(PresetRecord, crc));
+}
+
+bool areBandGainsValid(const float *gain, uint8_t count)
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        // Also false for NaN
+        if (!(isfinite(gain[i]) && gain[i] >= 0.0f))
+            return false;
+    }
+
+    return true;
+}
+
+bool isPresetValid(const Preset &preset)
+{
+    return areBandGainsValid(preset.bandGain, kPresetBandCount) && isfinite(preset.beatThreshold) && isfinite(preset.sensitivityMax) && preset.sensitivityMax > 0.0f;
+}
+
+void sealPresetRecord(PresetRecord &record)
+{
+    record.magic = kPresetRecordMagic;
+    record.version = kPresetRecordVersion;
+    record.crc = recordCrc(record);
+}
+
+PresetRecordStatus checkPresetRecord(const PresetRecord &record, size_t length)
+{
+    if (length != sizeof(record))
+        return PresetRecordStatus::Missing;
+
+    if (record.magic != kPresetRecordMagic || record.version != kPresetRecordVersion)
+        return PresetRecordStatus::Outdated;
+
+    if (record.crc != recordCrc(record) || record.count == 0 || record.count > kPresetMaxCount ||
+        record.active >= record.count)
+    {
+        return PresetRecordStatus::Corrupt;
+    }
+
+    // The CRC only proves the record is what was written, not that it was sane
+    for (uint8_t i = 0; i < record.count; i++)
+    {
+        if (!isPresetValid(record.presets[i]))
+            return PresetRecordStatus::Corrupt;
+    }
+
+    return PresetRecordStatus::Valid;
+}
+
+int8_t newestPresetRecord(const PresetRecordStatus status[2], const PresetRecord record[2])
+{
+    bool isValid0 = status[0] == PresetRecordStatus::Valid;
+    bool isValid1 = status[1] == PresetRecordStatus::Valid;
+
+    if (isValid0 && isValid1)
+    {
+        // Sequence numbers may wrap
+        return (int32_t)(record[1].sequence - record[0].sequence) > 0 ? 1 : 0;
+    }
+
+    if (isValid0)
+        return 0;
+
+    return isValid1 ? 1 : -1;
+}
@@ -0,0 +1,185 @@
+#include "Presets.h"
+#include "Effects.h"
+#include "Palette.h"
+#include <Preferences.h>
+#include <stdio.h>
+#include <string.h>
+
+PresetStore presetStore;
+
+const char *kPresetNamespace = "audiovis";
+const char *kPresetKeys[2] = {"presets0", "presets1"};
+const char *kPresetLegacyKey = "presets"; // Single record of version 2 and before
+
+PresetRecordStatus PresetStore::readSlot(uint8_t slot, PresetRecord &record)
+{
+    Preferences prefs;
+
+    if (!prefs.begin(kPresetNamespace, true))
+        return PresetRecordStatus::Missing;
+
+    size_t length = prefs.getBytes(kPresetKeys[slot], &record, sizeof(record));
+    prefs.end();
+
+    return checkPresetRecord(record, length);
+}
+
+bool PresetStore::writeSlot(uint8_t slot, const PresetRecord &record)
+{
+    Preferences prefs;
+
+    if (!prefs.begin(kPresetNamespace, false))
+        return false;
+
+    // NVS writes the new entry before erasing the old one, so a power loss keeps either version
+    size_t length = prefs.putBytes(kPresetKeys[slot], &record, sizeof(record));
+
+    if (prefs.isKey(kPresetLegacyKey))
+    {
+        prefs.remove(kPresetLegacyKey);
+    }
+    prefs.end();
+
+    return length == sizeof(record);
+}
+
+bool PresetStore::load(const Preset &live)
+{
+    static PresetRecord records[2];
+    PresetRecordStatus status[2];
+
+    for (uint8_t slot = 0; slot < 2; slot++)
+    {
+        status[slot] = readSlot(slot, records[slot]);
+
+        if (status[slot] == PresetRecordStatus::Outdated)
+        {
+            log_w("Preset record %d has an unsupported version.", slot);
+        }
+        else if (status[slot] == PresetRecordStatus::Corrupt)
+        {
+            log_e("Preset record %d corrupt.", slot);
+        }
+    }
+
+    int8_t newest = newestPresetRecord(status, records);
+
+    if (newest < 0)
+    {
+        log_w("No usable presets stored, using defaults.");
+        loadDefaults(live);
+        return false;
+    }
+
+    if (status[1 - newest] != PresetRecordStatus::Valid && status[1 - newest] != PresetRecordStatus::Missing)
+    {
+        log_w("Using preset record %d, the last good one.", newest);
+    }
+
+    record_ = records[newest];
+    slot_ = newest;
+    return true;
+}
+
+bool PresetStore::save()
+{
+    // Never overwrite the record just loaded, so a failed or damaged write leaves the last good one
+    uint8_t slot = 1 - slot_;
+
+    record_.sequence++;
+    sealPresetRecord(record_);
+
+    if (!writeSlot(slot, record_))
+    {
+        log_e("Failed to save presets.");
+        return false;
+    }
+
+    slot_ = slot;
+    return true;
+}
+
+static Preset makePreset(const Preset &live, const char *name, EffectId effect, PaletteId palette, uint8_t bassHue)
+{
+    Preset preset = live;
+
+    memset(preset.name, 0, sizeof(preset.name));
+    strncpy(preset.name, name, sizeof(preset.name) - 1);
+    preset.effect = (uint8_t)effect;
+    preset.palette = (uint8_t)palette;
+    preset.modifiers = 0;
+    preset.bassHue = bassHue;
+    preset.colorStep = 1;
+    preset.followPitch = 0;
+    preset.dynamicEffects = 0;
+
+    return preset;
+}
+
+void PresetStore::loadDefaults(const Preset &live)
+{
+    memset(&record_, 0, sizeof(record_));
+
+    // The shows of the BLE mode commands, starting with the strip off as before
+    record_.presets[0] = makePreset(live, "off", EffectId::Off, PaletteId::Rainbow, 160);
+    record_.presets[1] = makePreset(live, "default", EffectId::Default, PaletteId::Rainbow, 160);
+    record_.presets[2] = makePreset(live, "christmas", EffectId::TwoTone, PaletteId::Christmas, 160);
+    record_.presets[3] = makePreset(live, "barbie", EffectId::TwoTone, PaletteId::Barbie, 175);
+    record_.presets[4] = makePreset(live, "usa", EffectId::TwoTone, PaletteId::Usa, 160);
+    record_.presets[5] = makePreset(live, "harmony", EffectId::Default, PaletteId::Rainbow, 160);
+    record_.presets[5].followPitch = 1;
+
+    record_.count = 6;
+    record_.active = 0;
+}
+
+bool PresetStore::select(uint8_t idx)
+{
+    if (idx >= record_.count)
+        return false;
+
+    record_.active = idx;
+    return true;
+}
+
+bool PresetStore::setPreset(uint8_t idx, const Preset &preset)
+{
+    // Presets can be replaced or appended
+    if (idx > record_.count || idx >= kMaxPresets)
+        return false;
+
+    if (preset.effect >= (uint8_t)EffectId::Count || preset.palette >= (uint8_t)PaletteId::Count)
+        return false;
+
+    // NaN or infinite gains would spread through the whole analysis
+    if (!isPresetValid(preset))
+        return false;
+
+    record_.presets[idx] = preset;
+    record_.presets[idx].name[kPresetNameLength - 1] = '\0';
+
+    if (idx == record_.count)
+    {
+        record_.count++;
+    }
+
+    return true;
+}
+
+size_t PresetStore::format(char *buffer, size_t size) const
+{
+    size_t length = 0;
+
+    for (uint8_t i = 0; i < record_.count && length < size; i++)
+    {
+        int n = snprintf(buffer + length, size - length, "%d:%s%s\n", i, record_.presets[i].name,
+                         (i == record_.active) ? "*" : "");
+
+        if (n < 0)
+            break;
+
+        length += n;
+    }
+
+    return (length < size) ? length : size - 1;
+}
@@ -0,0 +1,31 @@
+#include "SampleConditioning.h"
+#include <stdlib.h>
+
+void conditionSamples(const int16_t *raw, float *real, float *imag, uint16_t count,
+                      int16_t dcOffset, float scale, BlockStats &stats)
+{
+    int32_t sum = 0;
+    uint64_t sumSquares = 0;
+    uint16_t peak = stats.peak;
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        int16_t sample = raw[i];
+        sum += sample;
+
+        // Subtract the DC offset, then store in the (possibly aliased) FFT input array
+        int16_t v = sample - dcOffset;
+        sumSquares += (int32_t)v * v;
+
+        uint16_t magnitude = abs(v);
+        if (magnitude > peak)
+            peak = magnitude;
+
+        real[i] = scale * v;
+        imag[i] = 0.0f;
+    }
+
+    stats.sum += sum;
+    stats.sumSquares += sumSquares;
+    stats.peak = peak;
+}
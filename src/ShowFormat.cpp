@@ -0,0 +1,288 @@
+#include "ShowFormat.h"
+#include <string.h>
+
+static inline uint16_t zigzag(int16_t v)
+{
+    return ((uint16_t)v << 1) ^ (uint16_t)(v >> 15);
+}
+
+static inline int16_t unzigzag(uint16_t u)
+{
+    return (int16_t)(u >> 1) ^ -(int16_t)(u & 1);
+}
+
+/* Nibble packer, high nibble first, with a hard end */
+class NibbleWriter
+{
+private:
+    uint8_t *pos_;
+    uint8_t *end_;
+    bool isHigh_ = true;
+
+public:
+    bool overflow = false;
+
+    NibbleWriter(uint8_t *begin, uint8_t *end) : pos_(begin), end_(end) {}
+
+    void write(uint8_t nibble)
+    {
+        if (pos_ == end_)
+        {
+            overflow = true;
+            return;
+        }
+
+        if (isHigh_)
+        {
+            *pos_ = nibble << 4;
+        }
+        else
+        {
+            *pos_++ |= nibble;
+        }
+
+        isHigh_ = !isHigh_;
+    }
+
+    uint8_t *flush()
+    {
+        return isHigh_ ? pos_ : pos_ + 1;
+    }
+};
+
+class NibbleReader
+{
+private:
+    const uint8_t *pos_;
+    const uint8_t *end_;
+    bool isHigh_ = true;
+
+public:
+    bool underflow = false;
+
+    NibbleReader(const uint8_t *begin, const uint8_t *end) : pos_(begin), end_(end) {}
+
+    uint8_t read()
+    {
+        if (pos_ == end_)
+        {
+            underflow = true;
+            return 0;
+        }
+
+        isHigh_ = !isHigh_;
+
+        return isHigh_ ? (*pos_++ & 0x0F) : (*pos_ >> 4);
+    }
+
+    const uint8_t *position() const
+    {
+        return isHigh_ ? pos_ : pos_ + 1;
+    }
+};
+
+/* ----- ShowEncoder ----- */
+
+size_t ShowEncoder::begin(uint8_t *buffer, size_t size)
+{
+    if (size < kShowHeaderSize)
+        return 0;
+
+    memcpy(buffer, kShowMagic, sizeof(kShowMagic));
+    buffer[4] = kShowVersion;
+    buffer[5] = kShowBandCount;
+    buffer[6] = kShowKeyframeInterval & 0xFF;
+    buffer[7] = kShowKeyframeInterval >> 8;
+
+    encodedMicros_ = 0;
+    sinceKeyframe_ = 0;
+    isStarted_ = false;
+
+    return kShowHeaderSize;
+}
+
+size_t ShowEncoder::encode(const ShowFrame &frame, uint8_t *buffer, size_t size)
+{
+    if (size < kShowMaxRecordSize)
+        return 0;
+
+    uint8_t *p = buffer;
+    bool isKeyframe = !isStarted_ || sinceKeyframe_ >= kShowKeyframeInterval;
+
+    *p++ = (isKeyframe ? kShowFlagKeyframe : 0) | (frame.isBeat ? kShowFlagBeat : 0);
+
+    // Time relative to the previous record as decoded, so rounding never accumulates; the show starts with the first frame
+    if (!isStarted_)
+        encodedMicros_ = frame.timeMicros;
+
+    uint32_t ticks = (frame.timeMicros - encodedMicros_ + 50) / 100;
+    ticks = (ticks < (1u << 28)) ? ticks : (1u << 28) - 1;
+    encodedMicros_ += ticks * 100;
+
+    do
+    {
+        uint8_t byte = ticks & 0x7F;
+        ticks >>= 7;
+        *p++ = ticks ? (byte | 0x80) : byte;
+    } while (ticks);
+
+    if (isKeyframe)
+    {
+        memcpy(p, frame.lightness, kShowBandCount);
+        p += kShowBandCount;
+        sinceKeyframe_ = 1;
+    }
+    else
+    {
+        uint8_t *mask = p;
+        memset(mask, 0, kShowBandCount / 8);
+
+        NibbleWriter writer(p + kShowBandCount / 8, buffer + size);
+
+        for (uint8_t band = 0; band < kShowBandCount; band++)
+        {
+            int16_t delta = frame.lightness[band] - previous_[band];
+
+            if (delta == 0)
+                continue;
+
+            mask[band >> 3] |= 1 << (band & 7);
+
+            uint16_t code = zigzag(delta);
+
+            if (code < 16)
+            {
+                writer.write(code);
+            }
+            else
+            {
+                writer.write(0);
+                writer.write(code >> 8);
+                writer.write((code >> 4) & 0x0F);
+                writer.write(code & 0x0F);
+            }
+        }
+
+        p = writer.flush();
+        sinceKeyframe_++;
+    }
+
+    memcpy(previous_, frame.lightness, kShowBandCount);
+    isStarted_ = true;
+
+    return p - buffer;
+}
+
+/* ----- ShowDecoder ----- */
+
+size_t ShowDecoder::begin(const uint8_t *buffer, size_t length)
+{
+    timeMicros_ = 0;
+    hasKeyframe_ = false;
+    isCorrupt = false;
+
+    if (length < kShowHeaderSize)
+        return 0;
+
+    if (memcmp(buffer, kShowMagic, sizeof(kShowMagic)) != 0 || buffer[4] != kShowVersion ||
+        buffer[5] != kShowBandCount)
+    {
+        isCorrupt = true;
+        return 0;
+    }
+
+    keyframeInterval_ = buffer[6] | (buffer[7] << 8);
+
+    return kShowHeaderSize;
+}
+
+size_t ShowDecoder::decode(const uint8_t *buffer, size_t length, ShowFrame &frame)
+{
+    const uint8_t *end = buffer + length;
+    const uint8_t *p = buffer;
+
+    if (p == end)
+        return 0;
+
+    uint8_t flags = *p++;
+    bool isKeyframe = flags & kShowFlagKeyframe;
+
+    uint32_t ticks = 0;
+
+    for (uint8_t shift = 0;; shift += 7)
+    {
+        if (p == end)
+            return 0;
+
+        if (shift > 21)
+        {
+            isCorrupt = true;
+            return 0;
+        }
+
+        ticks |= (uint32_t)(*p & 0x7F) << shift;
+
+        if (!(*p++ & 0x80))
+            break;
+    }
+
+    if (isKeyframe)
+    {
+        if (end - p < kShowBandCount)
+            return 0;
+
+        memcpy(frame.lightness, p, kShowBandCount);
+        p += kShowBandCount;
+    }
+    else
+    {
+        // The change mask needs a previous frame to apply to
+        if (!hasKeyframe_)
+        {
+            isCorrupt = true;
+            return 0;
+        }
+
+        if (end - p < kShowBandCount / 8)
+            return 0;
+
+        const uint8_t *mask = p;
+        NibbleReader reader(p + kShowBandCount / 8, end);
+
+        for (uint8_t band = 0; band < kShowBandCount; band++)
+        {
+            uint8_t value = previous_[band];
+
+            if (mask[band >> 3] & (1 << (band & 7)))
+            {
+                uint16_t code = reader.read();
+
+                if (code == 0)
+                {
+                    code = reader.read() << 8;
+                    code |= reader.read() << 4;
+                    code |= reader.read();
+                }
+
+                value += unzigzag(code);
+            }
+
+            frame.lightness[band] = value;
+        }
+
+        if (reader.underflow)
+            return 0;
+
+        p = reader.position();
+    }
+
+    timeMicros_ += ticks * 100;
+
+    frame.timeMicros = timeMicros_;
+    frame.isBeat = flags & kShowFlagBeat;
+
+    memcpy(previous_, frame.lightness, kShowBandCount);
+    hasKeyframe_ = true;
+
+    return p - buffer;
+}
@@ -0,0 +1,393 @@
+#include "ShowPlayer.h"
+#include <FastLED.h>
+#include "Particles.h"
+
+ShowPlayer showPlayer;
+ShowRecorder showRecorder;
+
+static_assert(kShowBandCount == AnalysisFrame::kBandCount, "Shows must hold all frequency bands");
+static_assert(ShowPlayer::kChunkSize >= kShowMaxRecordSize, "A chunk must hold the largest record");
+
+/* ----- Writer task ----- */
+const uint32_t kShowWriterStackSize = 3072;
+const UBaseType_t kShowWriterPriority = 1;
+const BaseType_t kShowWriterCore = 0;
+const TickType_t kShowWriterPollTicks = 100 / portTICK_PERIOD_MS;
+
+/* ----- ShowPlayer ----- */
+
+bool ShowPlayer::play(const char *path)
+{
+    stop();
+
+    file_ = LittleFS.open(path, "r");
+
+    if (!file_)
+    {
+        log_e("Show %s not found.", path);
+        return false;
+    }
+
+    chunkPos_ = 0;
+    chunkEnd_ = 0;
+    isEndOfFile_ = false;
+    queueHead_ = 0;
+    queueCount_ = 0;
+
+    size_t headerSize = readChunk() ? decoder_.begin(chunk_, chunkEnd_) : 0;
+
+    if (headerSize == 0)
+    {
+        log_e("%s is no show file.", path);
+        file_.close();
+        return false;
+    }
+
+    chunkPos_ = headerSize;
+
+    positionMicros_ = 0;
+    lastUpdateMicros_ = micros();
+    liveBeatMicros_ = lastUpdateMicros_ - kBeatLockMicros; // No sync before the first live beat
+    isHolding_ = false;
+    syncJumps_ = 0;
+    syncHolds_ = 0;
+    frame_ = {};
+    isPlaying_ = true;
+
+    log_i("Playing show %s", path);
+
+    return true;
+}
+
+void ShowPlayer::stop()
+{
+    if (!isPlaying_)
+        return;
+
+    file_.close();
+    isPlaying_ = false;
+
+    log_i("Show stopped. Sync: %u jumps, %u holds", syncJumps_, syncHolds_);
+}
+
+// Move the undecoded rest to the front of the chunk and fill it up from the file
+bool ShowPlayer::readChunk()
+{
+    if (isEndOfFile_)
+        return false;
+
+    uint16_t rest = chunkEnd_ - chunkPos_;
+    memmove(chunk_, chunk_ + chunkPos_, rest);
+
+    size_t length = file_.read(chunk_ + rest, kChunkSize - rest);
+
+    chunkPos_ = 0;
+    chunkEnd_ = rest + length;
+
+    if (length == 0)
+        isEndOfFile_ = true;
+
+    return length > 0;
+}
+
+// Decode frames until the lookahead is full, returns false if no frame is left
+bool ShowPlayer::fillQueue()
+{
+    while (queueCount_ < kLookahead)
+    {
+        ShowFrame &slot = queue_[(queueHead_ + queueCount_) % kLookahead];
+        size_t length = decoder_.decode(chunk_ + chunkPos_, chunkEnd_ - chunkPos_, slot);
+
+        if (length > 0)
+        {
+            chunkPos_ += length;
+            queueCount_++;
+            continue;
+        }
+
+        if (decoder_.isCorrupt)
+        {
+            log_e("Corrupt show record, playback ends.");
+            isEndOfFile_ = true;
+            break;
+        }
+
+        // Incomplete record at the end of the chunk
+        if (!readChunk())
+            break;
+    }
+
+    return queueCount_ > 0;
+}
+
+const AnalysisFrame *ShowPlayer::update(uint32_t nowMicros, bool isLiveBeat)
+{
+    if (!isPlaying_)
+        return nullptr;
+
+    uint32_t elapsedMicros = nowMicros - lastUpdateMicros_;
+    elapsedMicros = (elapsedMicros < kMaxStepMicros) ? elapsedMicros : kMaxStepMicros;
+    lastUpdateMicros_ = nowMicros;
+
+    bool isLocked = (nowMicros - liveBeatMicros_) < kBeatLockMicros;
+
+    if (isLiveBeat)
+    {
+        liveBeatMicros_ = nowMicros;
+    }
+
+    if (!fillQueue())
+    {
+        stop();
+        return nullptr;
+    }
+
+    const ShowFrame &next = queue_[queueHead_];
+
+    if (isHolding_)
+    {
+        // Released by the live beat, or after the sync window if it does not come
+        if (isLiveBeat || nowMicros - holdStartMicros_ > kSyncWindowMicros)
+        {
+            isHolding_ = false;
+            positionMicros_ = next.timeMicros;
+        }
+    }
+    else
+    {
+        positionMicros_ += elapsedMicros;
+
+        // Live beat shortly before a recorded one: the show is late, jump ahead to the recorded beat
+        if (isLiveBeat && isLocked)
+        {
+            for (uint8_t i = 0; i < queueCount_; i++)
+            {
+                const ShowFrame &ahead = queue_[(queueHead_ + i) % kLookahead];
+
+                if (ahead.timeMicros > positionMicros_ + kSyncWindowMicros)
+                    break;
+
+                if (ahead.isBeat && ahead.timeMicros > positionMicros_)
+                {
+                    positionMicros_ = ahead.timeMicros;
+                    syncJumps_++;
+                    break;
+                }
+            }
+        }
+
+        // Recorded beat due without a live beat shortly before it: the show is early, wait for the live beat
+        if (isLocked && next.isBeat && next.timeMicros <= positionMicros_ &&
+            nowMicros - liveBeatMicros_ > kSyncWindowMicros)
+        {
+            isHolding_ = true;
+            holdStartMicros_ = nowMicros;
+            syncHolds_++;
+        }
+    }
+
+    if (isHolding_)
+        return &frame_;
+
+    // Show every frame that is due; the lightness of the last one and the beats of all of them
+    bool isBeat = false;
+    bool hasNewFrame = false;
+
+    while ((queueCount_ > 0 || fillQueue()) && queue_[queueHead_].timeMicros <= positionMicros_)
+    {
+        const ShowFrame &due = queue_[queueHead_];
+
+        memcpy(frame_.lightness, due.lightness, sizeof(frame_.lightness));
+        isBeat |= due.isBeat;
+        hasNewFrame = true;
+
+        queueHead_ = (queueHead_ + 1) % kLookahead;
+        queueCount_--;
+    }
+
+    frame_.isBeatHit = isBeat;
+    frame_.timestamp = nowMicros;
+
+    if (hasNewFrame)
+        frame_.sequence++;
+
+    return &frame_;
+}
+
+/* ----- ShowRecorder ----- */
+
+bool ShowRecorder::begin(size_t bufferSize)
+{
+    buffer_ = xStreamBufferCreate(bufferSize, 1);
+
+    if (buffer_ == nullptr)
+    {
+        log_e("Failed to create show recording buffer.");
+        return false;
+    }
+
+    if (xTaskCreatePinnedToCore(writerTask, "showWriter", kShowWriterStackSize, this, kShowWriterPriority, nullptr, kShowWriterCore) != pdPASS)
+    {
+        log_e("Failed to start show writer task.");
+        return false;
+    }
+
+    return true;
+}
+
+bool ShowRecorder::record(const char *path)
+{
+    if (buffer_ == nullptr || isRecording_ || isClosing_)
+    {
+        log_w("Recorder busy.");
+        return false;
+    }
+
+    file_ = LittleFS.open(path, "w");
+
+    if (!file_)
+    {
+        log_e("Failed to create show %s.", path);
+        return false;
+    }
+
+    uint8_t header[kShowHeaderSize];
+    size_t length = encoder_.begin(header, sizeof(header));
+    xStreamBufferSend(buffer_, header, length, 0);
+
+    frames_ = 0;
+    bytes_ = length;
+    droppedFrames_ = 0;
+    isRecording_ = true;
+
+    log_i("Recording show %s", path);
+
+    return true;
+}
+
+void ShowRecorder::add(const AnalysisFrame &frame)
+{
+    if (!isRecording_)
+        return;
+
+    // Skip the frame before it touches the delta coding if the writer is behind
+    if (xStreamBufferSpacesAvailable(buffer_) < kShowMaxRecordSize)
+    {
+        droppedFrames_++;
+        return;
+    }
+
+    ShowFrame showFrame;
+    showFrame.timeMicros = frame.timestamp;
+    showFrame.isBeat = frame.isBeatHit;
+    memcpy(showFrame.lightness, frame.lightness, sizeof(showFrame.lightness));
+
+    uint8_t record[kShowMaxRecordSize];
+    size_t length = encoder_.encode(showFrame, record, sizeof(record));
+
+    xStreamBufferSend(buffer_, record, length, 0);
+
+    frames_++;
+    bytes_ += length;
+}
+
+void ShowRecorder::stop()
+{
+    if (!isRecording_)
+        return;
+
+    isRecording_ = false;
+    isClosing_ = true;
+
+    log_i("Recording stopped: %u frames, %u bytes, %u dropped", frames_, bytes_, droppedFrames_);
+}
+
+void ShowRecorder::writerTask(void *param)
+{
+    ShowRecorder *self = static_cast<ShowRecorder *>(param);
+    uint8_t chunk[256];
+
+    for (;;)
+    {
+        size_t length = xStreamBufferReceive(self->buffer_, chunk, sizeof(chunk), kShowWriterPollTicks);
+
+        if (length > 0)
+        {
+            self->file_.write(chunk, length);
+        }
+        else if (self->isClosing_)
+        {
+            // Everything queued before stop() has been written
+            self->file_.close();
+            self->isClosing_ = false;
+        }
+    }
+}
+
+/* ----- Benchmark ----- */
+
+void printShowBenchmark()
+{
+    const uint16_t kFrames = 512;
+    const uint32_t kFrameMicros = 46440; // 2048 samples at 44.1 kHz
+    const size_t kRawFrameSize = kShowBandCount + 1 + 4; // Lightness, beat flag and timestamp
+
+    ShowEncoder encoder;
+    ShowDecoder decoder;
+    ShowFrame frame = {};
+    ShowFrame decoded;
+    uint8_t record[kShowMaxRecordSize];
+    FastRandom rng;
+
+    size_t encodedBytes = encoder.begin(record, sizeof(record));
+    decoder.begin(record, encodedBytes);
+
+    uint32_t encodeMicros = 0;
+    uint32_t decodeMicros = 0;
+    uint16_t mismatches = 0;
+
+    for (uint16_t f = 0; f < kFrames; f++)
+    {
+        // Synthetic music: bands drifting with a slow sweep, noise, a beat every 11 frames and silent breaks
+        frame.timeMicros = f * kFrameMicros;
+        frame.isBeat = (f % 11) == 0;
+
+        for (uint8_t band = 0; band < kShowBandCount; band++)
+        {
+            int16_t target = 120 + (sin8(f * 2 + band * 12) - 128) * 3 / 4 + (int16_t)rng.below(31) - 15;
+
+            if (frame.isBeat && band < 8)
+                target += 60;
+
+            if (f % 128 >= 112)
+                target = 0;
+
+            int16_t level = frame.lightness[band] + (target - frame.lightness[band]) * 3 / 8;
+            frame.lightness[band] = constrain(level, 0, 255);
+        }
+
+        unsigned long startMicros = micros();
+        size_t length = encoder.encode(frame, record, sizeof(record));
+        encodeMicros += micros() - startMicros;
+
+        startMicros = micros();
+        size_t decodedLength = decoder.decode(record, length, decoded);
+        decodeMicros += micros() - startMicros;
+
+        if (decodedLength != length || memcmp(decoded.lightness, frame.lightness, kShowBandCount) != 0 ||
+            decoded.isBeat != frame.isBeat)
+        {
+            mismatches++;
+        }
+
+        encodedBytes += length;
+    }
+
+    size_t rawBytes = kFrames * kRawFrameSize;
+
+    Serial.printf("Show codec: %u frames, %u -> %u bytes, ratio %.2f, %u mismatches\n",
+                  kFrames, rawBytes, encodedBytes, (float)rawBytes / encodedBytes, mismatches);
+    Serial.printf("Encode %.1f MB/s (%u us), decode %.1f MB/s (%u us)\n",
+                  (float)rawBytes / max(encodeMicros, (uint32_t)1), encodeMicros,
+                  (float)rawBytes / max(decodeMicros, (uint32_t)1), decodeMicros);
+}
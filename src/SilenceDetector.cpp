@@ -0,0 +1,48 @@
+#include "SilenceDetector.h"
+#include <math.h>
+
+// Lower bound of the noise floor, so a muted input does not disable the detection
+const float kMinNoiseFloor = 1.0f;
+
+float SilenceDetector::threshold() const
+{
+    float threshold = noiseFloor_ * marginFactor;
+
+    return (threshold < maxSilenceRms) ? threshold : maxSilenceRms;
+}
+
+bool SilenceDetector::update(float rms, uint16_t sampleCount, uint32_t nowMillis)
+{
+    // Track the noise floor
+    if (noiseFloor_ == 0.0f || rms < noiseFloor_)
+    {
+        noiseFloor_ = rms;
+    }
+    else
+    {
+        // Idle mode feeds single DMA buffers, active mode whole blocks
+        noiseFloor_ *= powf(floorRise, (float)sampleCount / kFloorRiseSamples);
+    }
+
+    if (noiseFloor_ < kMinNoiseFloor)
+    {
+        noiseFloor_ = kMinNoiseFloor;
+    }
+
+    if (rms >= threshold())
+    {
+        isQuiet_ = false;
+        isSilent_ = false;
+    }
+    else if (!isQuiet_)
+    {
+        isQuiet_ = true;
+        quietSinceMillis_ = nowMillis;
+    }
+    else if (nowMillis - quietSinceMillis_ >= holdMillis)
+    {
+        isSilent_ = true;
+    }
+
+    return isSilent_;
+}
@@ -0,0 +1,203 @@
+#include "StageProfiler.h"
+#include <stdio.h>
+
+StageProfiler stageProfiler;
+
+/*
+    Stage budgets in percent of the frame budget. The analysis stages scale
+    with the block size, the LED stages do not, so the shares fit the default
+    2048 point block and are tight at 512 points. The I2S wait is idle time.
+*/
+static const uint8_t kStageBudgetPercent[(uint8_t)Stage::Count] = {
+    0,   // I2SWait
+    4,   // Conditioning
+    25,  // FFT
+    10,  // Spectrum
+    8,   // Bands
+    1,   // Beat
+    15,  // Effects
+    3,   // Output
+    17,  // LedShow
+    100, // Frame
+};
+
+static_assert(sizeof(kStageBudgetPercent) == (uint8_t)Stage::Count, "Every stage needs a budget");
+
+/* ----- LatencyHistogram ----- */
+
+uint8_t LatencyHistogram::bucketIndex(uint32_t micros)
+{
+    if (micros < 4)
+        return micros;
+
+    // Position of the most significant bit selects the octave, the next two bits the bucket within it
+    uint8_t msb = 31 - __builtin_clz(micros);
+    uint8_t sub = (micros >> (msb - 2)) & 3;
+    uint16_t idx = (msb - 1) * 4 + sub;
+
+    return (idx < kBucketCount) ? idx : kBucketCount - 1;
+}
+
+uint32_t LatencyHistogram::bucketUpperBound(uint8_t idx)
+{
+    if (idx < 4)
+        return idx;
+
+    uint8_t msb = idx / 4 + 1;
+    uint8_t sub = idx % 4;
+
+    return ((4u + sub + 1) << (msb - 2)) - 1;
+}
+
+void LatencyHistogram::record(uint32_t micros)
+{
+    buckets_[bucketIndex(micros)]++;
+    count_++;
+    last_ = micros;
+
+    if (micros > max_)
+    {
+        max_ = micros;
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (uint8_t i = 0; i < kBucketCount; i++)
+    {
+        buckets_[i] = 0;
+    }
+
+    count_ = 0;
+    max_ = 0;
+    last_ = 0;
+}
+
+uint32_t LatencyHistogram::percentile(uint8_t percent) const
+{
+    if (count_ == 0)
+        return 0;
+
+    // Rank of the requested sample, rounded up
+    uint32_t rank = ((uint64_t)count_ * percent + 99) / 100;
+    uint32_t seen = 0;
+
+    for (uint8_t i = 0; i < kBucketCount; i++)
+    {
+        seen += buckets_[i];
+
+        if (seen >= rank)
+            return (i < kBucketCount - 1 && bucketUpperBound(i) < max_) ? bucketUpperBound(i) : max_;
+    }
+
+    return max_;
+}
+
+/* ----- StageProfiler ----- */
+
+const char *StageProfiler::stageName(Stage stage)
+{
+    switch (stage)
+    {
+    case Stage::I2SWait:
+        return "i2s";
+    case Stage::Conditioning:
+        return "cond";
+    case Stage::FFT:
+        return "fft";
+    case Stage::Spectrum:
+        return "spec";
+    case Stage::Bands:
+        return "bands";
+    case Stage::Beat:
+        return "beat";
+    case Stage::Effects:
+        return "fx";
+    case Stage::Output:
+        return "out";
+    case Stage::LedShow:
+        return "show";
+    case Stage::Frame:
+        return "frame";
+    default:
+        return "?";
+    }
+}
+
+void StageProfiler::setFrameBudget(uint32_t micros)
+{
+    frameBudgetMicros_ = micros;
+
+    for (uint8_t i = 0; i < (uint8_t)Stage::Count; i++)
+    {
+        budgetMicros_[i] = micros * kStageBudgetPercent[i] / 100;
+    }
+}
+
+uint32_t StageProfiler::record(Stage stage, uint32_t start, uint32_t earlierTicks)
+{
+    uint32_t end = now();
+
+    recordTicks(stage, end - start + earlierTicks);
+
+    return end;
+}
+
+void StageProfiler::recordTicks(Stage stage, uint32_t ticks)
+{
+#ifdef ARDUINO
+    recordMicros(stage, ticks / cyclesPerMicro_);
+#else
+    recordMicros(stage, ticks);
+#endif
+}
+
+void StageProfiler::recordMicros(Stage stage, uint32_t micros)
+{
+    histograms_[(uint8_t)stage].record(micros);
+
+    if (budgetMicros_[(uint8_t)stage] > 0 && micros > budgetMicros_[(uint8_t)stage])
+    {
+        overruns_[(uint8_t)stage]++;
+    }
+}
+
+void StageProfiler::reset()
+{
+    for (uint8_t i = 0; i < (uint8_t)Stage::Count; i++)
+    {
+        histograms_[i].reset();
+        overruns_[i] = 0;
+    }
+
+    droppedFrames_ = 0;
+}
+
+size_t StageProfiler::format(char *buffer, size_t size) const
+{
+    size_t len = snprintf(buffer, size, "frames:%u dropped:%u missed:%u\n",
+                          (unsigned)histograms_[(uint8_t)Stage::Frame].count(),
+                          (unsigned)droppedFrames_, (unsigned)deadlineMisses());
+
+    for (uint8_t i = 0; i < (uint8_t)Stage::Count && len < size; i++)
+    {
+        const LatencyHistogram &hist = histograms_[i];
+
+        len += snprintf(buffer + len, size - len, "%s:%u/%u/%u/%u", stageName((Stage)i),
+                        (unsigned)hist.percentile(50), (unsigned)hist.percentile(95),
+                        (unsigned)hist.percentile(99), (unsigned)hist.max());
+
+        if (len < size && budgetMicros_[i] > 0)
+        {
+            len += snprintf(buffer + len, size - len, " budget:%u over:%u",
+                            (unsigned)budgetMicros_[i], (unsigned)overruns_[i]);
+        }
+
+        if (len < size)
+        {
+            len += snprintf(buffer + len, size - len, "\n");
+        }
+    }
+
+    return (len < size) ? len : size - 1;
+}
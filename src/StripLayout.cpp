@@ -0,0 +1,72 @@
+#include "StripLayout.h"
+
+bool StripLayout::build(LedMapEntry *entries, uint16_t numLeds, uint8_t bandCount, bool reversed, uint8_t bassShare)
+{
+    if (entries == nullptr || numLeds < 2 || numLeds > kMaxLeds || bandCount == 0)
+    {
+        log_e("Unsupported strip layout: %d LEDs, %d bands", numLeds, bandCount);
+        return false;
+    }
+
+    entries_ = entries;
+    numLeds_ = numLeds;
+    bandCount_ = bandCount;
+
+    // Each half of the strip shows the bass indicator followed by all bands
+    uint16_t half = numLeds / 2;
+
+    bassLeds_ = max((half * bassShare) >> 8, 1);
+
+    if (bassLeds_ >= half)
+    {
+        bassLeds_ = half - 1;
+    }
+
+    uint16_t freqLeds = half - bassLeds_;
+
+    for (uint16_t ledIdx = 0; ledIdx < half; ledIdx++)
+    {
+        LedMapEntry entry = {LedRole::Bass, 0, 0, 0, 0};
+
+        if (ledIdx >= bassLeds_)
+        {
+            uint16_t freqIdx = ledIdx - bassLeds_;
+
+            // Band position in 8.8 fixed point, spreading all bands over the frequency LEDs
+            uint32_t bandPos = 0;
+            uint8_t huePos = 255;
+
+            if (freqLeds > 1)
+            {
+                bandPos = ((uint32_t)freqIdx * (bandCount - 1) * 256) / (freqLeds - 1);
+                huePos = (freqIdx * 255) / (freqLeds - 1);
+            }
+
+            entry.role = LedRole::Band;
+            entry.band = bandPos >> 8;
+            entry.weight = bandPos & 0xFF;
+            entry.hue = huePos;
+        }
+
+        // A reversed segment is fed from its far end, so its table is stored back to front
+        uint16_t physIdx = reversed ? numLeds - 1 - ledIdx : ledIdx;
+        uint16_t physRevIdx = numLeds - 1 - physIdx;
+
+        entry.mirror = physRevIdx;
+        entries_[physIdx] = entry;
+
+        entry.mirror = physIdx;
+        entries_[physRevIdx] = entry;
+    }
+
+    // If the LED count is odd, give the extra one to the last band aka the center band
+    if (numLeds % 2)
+    {
+        entries_[half] = {LedRole::Center, (uint8_t)(bandCount - 1), 0, 255, half};
+    }
+
+    log_d("Strip layout: %d LEDs, %d bands, %d bass LEDs and %d frequency LEDs on each half.",
+          numLeds_, bandCount_, bassLeds_, freqLeds);
+
+    return true;
+}
@@ -0,0 +1,169 @@
+#include "Telemetry.h"
+
+Telemetry telemetry;
+
+/* ----- Writer task ----- */
+const uint32_t kWriterStackSize = 2048;
+const UBaseType_t kWriterPriority = 1;
+const BaseType_t kWriterCore = 0;
+
+static uint8_t *putU16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *putU32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+    return p + 4;
+}
+
+static uint8_t *putFloat(uint8_t *p, float v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return putU32(p, bits);
+}
+
+size_t encodeTelemetryFrame(uint8_t *buffer, size_t size, uint16_t sequence, const TelemetryFrame &frame)
+{
+    uint8_t bandCount = min(frame.bandCount, kTelemetryMaxBands);
+    size_t payloadLength = 2 + 4 + 4 + 4 + 1 + 1 + bandCount + 1 + 2 * frame.stageCount;
+
+    if (payloadLength > 255 || 4 + payloadLength + 2 > size)
+        return 0;
+
+    uint8_t *p = buffer;
+
+    *p++ = kTelemetrySync0;
+    *p++ = kTelemetrySync1;
+    *p++ = kTelemetryTypeAnalysis;
+    *p++ = payloadLength;
+
+    p = putU16(p, sequence);
+    p = putU32(p, frame.timestamp);
+    p = putFloat(p, frame.sensitivity);
+    p = putFloat(p, frame.magnitudeSum);
+    *p++ = frame.isBeatHit ? 1 : 0;
+
+    *p++ = bandCount;
+
+    memcpy(p, frame.lightness, bandCount);
+    p += bandCount;
+
+    *p++ = frame.stageCount;
+
+    for (uint8_t i = 0; i < frame.stageCount; i++)
+    {
+        p = putU16(p, min(frame.stageMicros[i], (uint32_t)0xFFFF));
+    }
+
+    // The CRC covers everything after the sync word
+    p = putU16(p, crc16Ccitt(buffer + 2, p - buffer - 2));
+
+    return p - buffer;
+}
+
+size_t encodeTelemetryGains(uint8_t *buffer, size_t size, uint16_t sequence, const float *gain, uint8_t bandCount)
+{
+    bandCount = min(bandCount, kTelemetryMaxBands);
+    size_t payloadLength = 2 + 1 + 2 * bandCount;
+
+    if (payloadLength > 255 || 4 + payloadLength + 2 > size)
+        return 0;
+
+    uint8_t *p = buffer;
+
+    *p++ = kTelemetrySync0;
+    *p++ = kTelemetrySync1;
+    *p++ = kTelemetryTypeGains;
+    *p++ = payloadLength;
+
+    p = putU16(p, sequence);
+    *p++ = bandCount;
+
+    for (uint8_t i = 0; i < bandCount; i++)
+    {
+        p = putU16(p, constrain(lroundf(gain[i] * 256.0f), 0L, 0xFFFFL));
+    }
+
+    p = putU16(p, crc16Ccitt(buffer + 2, p - buffer - 2));
+
+    return p - buffer;
+}
+
+bool Telemetry::begin(size_t bufferSize)
+{
+    buffer_ = xStreamBufferCreate(bufferSize, 1);
+
+    if (buffer_ == nullptr)
+    {
+        log_e("Failed to create telemetry buffer.");
+        return false;
+    }
+
+    if (xTaskCreatePinnedToCore(writerTask, "telemetry", kWriterStackSize, this, kWriterPriority, nullptr, kWriterCore) != pdPASS)
+    {
+        log_e("Failed to start telemetry task.");
+        return false;
+    }
+
+    return true;
+}
+
+void Telemetry::publish(const TelemetryFrame &frame)
+{
+    if (!isEnabled_)
+        return;
+
+    uint8_t encoded[kTelemetryMaxFrameSize];
+    size_t length = encodeTelemetryFrame(encoded, sizeof(encoded), sequence_++, frame);
+
+    send(encoded, length);
+}
+
+void Telemetry::publishGains(const float *gain, uint8_t bandCount)
+{
+    if (!isEnabled_)
+        return;
+
+    uint8_t encoded[kTelemetryMaxFrameSize];
+    size_t length = encodeTelemetryGains(encoded, sizeof(encoded), sequence_, gain, bandCount);
+
+    send(encoded, length);
+}
+
+bool Telemetry::send(const uint8_t *data, size_t length)
+{
+    // Never block the analysis, a missing sequence number tells the decoder about the loss
+    if (buffer_ == nullptr || length == 0 || xStreamBufferSpacesAvailable(buffer_) < length)
+    {
+        droppedFrames_++;
+        return false;
+    }
+
+    xStreamBufferSend(buffer_, data, length, 0);
+
+    return true;
+}
+
+void Telemetry::writerTask(void *param)
+{
+    Telemetry *self = static_cast<Telemetry *>(param);
+    uint8_t chunk[256];
+
+    for (;;)
+    {
+        size_t length = xStreamBufferReceive(self->buffer_, chunk, sizeof(chunk), portMAX_DELAY);
+
+        if (length > 0)
+        {
+            Serial.write(chunk, length);
+        }
+    }
+}
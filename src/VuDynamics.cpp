@@ -0,0 +1,54 @@
+#include "VuDynamics.h"
+
+void VuDynamics::process(const uint8_t *lightness)
+{
+    for (uint8_t i = 0; i < kBandCount; i++)
+    {
+        uint16_t target = lightness[i] << 8;
+        uint16_t level = level_[i];
+
+        if (target > level)
+        {
+            level += ((uint32_t)(target - level) * (attack + 1)) >> 8;
+        }
+        else if (target < level)
+        {
+            // At least one step, so the level always reaches the target
+            uint16_t step = ((uint32_t)(level - target) * release) >> 8;
+            level -= (step > 0) ? step : 1;
+        }
+
+        uint16_t peak = peak_[i];
+
+        if (level >= peak)
+        {
+            peak = level;
+            hold_[i] = holdFrames;
+            velocity_[i] = 0;
+        }
+        else if (hold_[i] > 0)
+        {
+            hold_[i]--;
+        }
+        else
+        {
+            velocity_[i] += gravity;
+            peak = (peak > level + velocity_[i]) ? peak - velocity_[i] : level;
+        }
+
+        level_[i] = level;
+        peak_[i] = peak;
+        levelOut_[i] = level >> 8;
+        peakOut_[i] = peak >> 8;
+    }
+}
+
+void VuDynamics::reset()
+{
+    memset(level_, 0, sizeof(level_));
+    memset(peak_, 0, sizeof(peak_));
+    memset(velocity_, 0, sizeof(velocity_));
+    memset(hold_, 0, sizeof(hold_));
+    memset(levelOut_, 0, sizeof(levelOut_));
+    memset(peakOut_, 0, sizeof(peakOut_));
+}
@@ -21,13 +21,21 @@
 */
 
 #include <Arduino.h>
+#include <LittleFS.h>
 #include <M5StickCPlus.h>
 #include <NimBLEDevice.h>
+#include "CpuLoad.h"
 #include "FFTProcessor.h"
 #include "LightingProcessor.h"
+#include "OverloadController.h"
+#include "Presets.h"
+#include "ShowPlayer.h"
+#include "StageProfiler.h"
+#include "Telemetry.h"
 
 FFTProcessor fftProcessor;
 LightingProcessor light;
+OverloadController overload;
 
 /*------------------------------------------------------------------------------
   BLE instances & variables
@@ -35,6 +43,9 @@ LightingProcessor light;
 BLEServer *pServer = NULL;
 BLECharacteristic *pModeCharacteristic;
 BLECharacteristic *pAddonCharacteristic;
+BLECharacteristic *pStatsCharacteristic;
+BLECharacteristic *pPresetCharacteristic;
+BLECharacteristic *pBandsCharacteristic;
 
 // bool deviceConnected = false;
 // bool oldDeviceConnected = false;
@@ -43,6 +54,29 @@ String currentMode = "";
 #define SERVICE_UUID "78ac6f8b-8b47-40aa-b5ce-af08cb78befd"
 #define CHARACTERISTIC_MODE_UUID "a216b303-23bc-4b36-8006-55e2ff2cc8e7"
 #define CHARACTERISTIC_ADDON_UUID "847dba9e-8db5-447f-bb17-02a5ee2defc6"
+#define CHARACTERISTIC_STATS_UUID "b1c461fa-840d-4d68-bfb4-86f51b6c9525"
+#define CHARACTERISTIC_PRESET_UUID "3f1a7c52-9d0e-4b8a-a6f3-2c5e8d41b907"
+#define CHARACTERISTIC_BANDS_UUID "c7d2e9a4-5b16-4f3e-8a0d-61b4f7c2e815"
+
+// Band configuration over BLE: 64 band gains, or 64 band end frequencies [Hz] followed by 64 gains, as float
+const uint8_t kBleBandCount = 64;
+
+// Latency report, per stage p50/p95/p99/max, budget and overruns in microseconds, and the load of both cores.
+// Only the loop writes it; the BLE task formats into a buffer of its own.
+char statsReport[512];
+
+/*
+  Preset requests written over BLE, handled by the loop between two frames:
+  1 byte                   select the preset with this index
+  1 + sizeof(Preset) bytes store the preset at this index and select it
+*/
+uint8_t presetRequest[1 + sizeof(Preset)];
+size_t presetRequestLength = 0;
+portMUX_TYPE presetRequestMux = portMUX_INITIALIZER_UNLOCKED;
+
+// List of presets for BLE reads, formatted by the loop whenever the store changes and guarded by presetRequestMux
+char presetList[PresetStore::kMaxPresets * (kPresetNameLength + 8)];
+size_t presetListLength = 0;
 
 /*------------------------------------------------------------------------------
   BLE Server callback
@@ -81,6 +115,31 @@ class CharacteristicCallbacks : public NimBLECharacteristicCallbacks
 {
     void onRead(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) override
     {
+        // Refresh the latency report before it is sent to the client
+        if (pCharacteristic == pStatsCharacteristic)
+        {
+            char report[sizeof(statsReport)];
+            size_t len = stageProfiler.format(report, sizeof(report));
+            len += cpuLoad.format(report + len, sizeof(report) - len);
+            pCharacteristic->setValue((const uint8_t *)report, len);
+            return;
+        }
+
+        // List of presets as last formatted by the loop, the store itself is only touched there
+        if (pCharacteristic == pPresetCharacteristic)
+        {
+            char list[sizeof(presetList)];
+            size_t len;
+
+            portENTER_CRITICAL(&presetRequestMux);
+            len = presetListLength;
+            memcpy(list, presetList, len);
+            portEXIT_CRITICAL(&presetRequestMux);
+
+            pCharacteristic->setValue((const uint8_t *)list, len);
+            return;
+        }
+
         Serial.printf("%s : onRead(), value: %s\n",
                       pCharacteristic->getUUID().toString().c_str(),
                       pCharacteristic->getValue().c_str());
@@ -88,17 +147,53 @@ class CharacteristicCallbacks : public NimBLECharacteristicCallbacks
 
     void onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) override
     {
+        // New band tables are built right here on the BLE task, the analyzer picks them up between frames
+        if (pCharacteristic == pBandsCharacteristic)
+        {
+            NimBLEAttValue value = pCharacteristic->getValue();
+            float config[2 * kBleBandCount];
+
+            if (value.size() == sizeof(config))
+            {
+                memcpy(config, value.data(), sizeof(config));
+                fftProcessor.setBands(config, config + kBleBandCount);
+            }
+            else if (value.size() == sizeof(config) / 2)
+            {
+                memcpy(config, value.data(), sizeof(config) / 2);
+                fftProcessor.setBandGains(config);
+            }
+            return;
+        }
+
+        if (pCharacteristic == pPresetCharacteristic)
+        {
+            NimBLEAttValue value = pCharacteristic->getValue();
+
+            if (value.size() == 1 || value.size() == sizeof(presetRequest))
+            {
+                portENTER_CRITICAL(&presetRequestMux);
+                memcpy(presetRequest, value.data(), value.size());
+                presetRequestLength = value.size();
+                portEXIT_CRITICAL(&presetRequestMux);
+            }
+            return;
+        }
+
         Serial.printf("%s : onWrite(), value: %s\n",
                       pCharacteristic->getUUID().toString().c_str(),
                       pCharacteristic->getValue().c_str());
 
         //if (pCharacteristic->getUUID().toString().c_str() == CHARACTERISTIC_MODE_UUID) {
             currentMode = pCharacteristic->getValue().c_str();
-            
-            M5.Lcd.setCursor(0,40);
-            M5.Lcd.setTextSize(4);
-            M5.Lcd.setTextColor(GREEN, BLACK);
-            M5.Lcd.printf("%s          ", currentMode);
+
+            if (fftProcessor.isDisplayEnabled())
+            {
+                M5.Lcd.setCursor(0,40);
+                M5.Lcd.setTextSize(4);
+                M5.Lcd.setTextColor(GREEN, BLACK);
+                M5.Lcd.printf("%s          ", currentMode);
+            }
         //}
     }
 
@@ -157,19 +252,64 @@ class DescriptorCallbacks : public NimBLEDescriptorCallbacks
 /*----------------------------------------------------------------------------*/
 
 
-void setup()
+/*------------------------------------------------------------------------------
+  Boot milestones, in milliseconds since the application started
+  ----------------------------------------------------------------------------*/
+struct BootMilestone
+{
+  const char *name;
+  uint32_t millis;
+};
+
+const uint8_t kMaxBootMilestones = 12;
+BootMilestone bootMilestones[kMaxBootMilestones];
+uint8_t bootMilestoneCount = 0;
+portMUX_TYPE bootMilestoneMux = portMUX_INITIALIZER_UNLOCKED;
+bool isFirstFrameShown = false;
+
+// May be called from the background init tasks
+void bootMilestone(const char *name)
 {
+  portENTER_CRITICAL(&bootMilestoneMux);
+  if (bootMilestoneCount < kMaxBootMilestones)
+  {
+    bootMilestones[bootMilestoneCount++] = {name, (uint32_t)millis()};
+  }
+  portEXIT_CRITICAL(&bootMilestoneMux);
+}
 
-/*----------------------------------------------------------------------------*/
-  log_d("M5.begin!");
-  M5.begin();
+void printBootReport()
+{
+  for (uint8_t i = 0; i < bootMilestoneCount; i++)
+  {
+    Serial.printf("Boot %4u ms: %s\n", bootMilestones[i].millis, bootMilestones[i].name);
+  }
+}
+
+/*------------------------------------------------------------------------------
+  Background initialization, runs on core 0 while audio and LEDs are running
+  ----------------------------------------------------------------------------*/
+const uint32_t kInitTaskStackSize = 4096;
+const UBaseType_t kInitTaskPriority = 1;
+const BaseType_t kInitTaskCore = 0;
+
+void displayInitTask(void *param)
+{
+  M5.Lcd.begin();
   M5.Lcd.setRotation(1);
   M5.Lcd.fillScreen(BLACK);
   M5.Lcd.setTextSize(4);
   M5.Lcd.setTextColor(BLUE, BLACK);
   M5.Lcd.println("DJ Lights ");
 
-/*----------------------------------------------------------------------------*/
+  fftProcessor.setDisplayEnabled(true);
+  bootMilestone("display ready");
+
+  vTaskDelete(nullptr);
+}
+
+void bleInitTask(void *param)
+{
   // 1. Create the BLE Device
   NimBLEDevice::init("DJ Lights");
 
@@ -189,6 +329,15 @@ void setup()
   pAddonCharacteristic->setValue("none");
   pAddonCharacteristic->setCallbacks(&chrCallbacks);
 
+  pStatsCharacteristic = pService->createCharacteristic(CHARACTERISTIC_STATS_UUID, NIMBLE_PROPERTY::READ);
+  pStatsCharacteristic->setCallbacks(&chrCallbacks);
+
+  pPresetCharacteristic = pService->createCharacteristic(CHARACTERISTIC_PRESET_UUID, NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::WRITE);
+  pPresetCharacteristic->setCallbacks(&chrCallbacks);
+
+  pBandsCharacteristic = pService->createCharacteristic(CHARACTERISTIC_BANDS_UUID, NIMBLE_PROPERTY::WRITE);
+  pBandsCharacteristic->setCallbacks(&chrCallbacks);
+
   // 5. Start the service(s)
   pService->start();
 
@@ -197,30 +346,303 @@ void setup()
   pServer->getAdvertising()->start();
 
   NimBLEDevice::startAdvertising();
+  bootMilestone("BLE advertising");
   Serial.println("Waiting for a client connection to notify...");
+
+  vTaskDelete(nullptr);
+}
+
+void storageInitTask(void *param)
+{
+  // Formats the partition on first use, which takes a few seconds
+  if (!LittleFS.begin(true))
+  {
+    log_e("Failed to mount LittleFS, shows are not available.");
+  }
+  bootMilestone("LittleFS mounted");
+
+  vTaskDelete(nullptr);
+}
+
+/*------------------------------------------------------------------------------
+  Shows
+  ----------------------------------------------------------------------------*/
+// Mode commands "show <name>", "record <name>" and "stop", returns true if the mode was one of them
+bool handleShowCommand(const String &mode)
+{
+  // Command words are not case sensitive, as in applyMode; the show name is a file name and kept as is
+  int separator = mode.indexOf(' ');
+  String command = (separator < 0) ? mode : mode.substring(0, separator);
+  command.toLowerCase();
+
+  if (separator < 0 && command == "stop")
+  {
+    showPlayer.stop();
+    showRecorder.stop();
+    return true;
+  }
+
+  if (separator < 0 || (command != "show" && command != "record"))
+    return false;
+
+  String path = String("/") + mode.substring(separator + 1) + ".show";
+
+  if (command == "show")
+  {
+    showPlayer.play(path.c_str());
+  }
+  else
+  {
+    showRecorder.record(path.c_str());
+  }
+
+  return true;
+}
+
+/*------------------------------------------------------------------------------
+  Presets
+  ----------------------------------------------------------------------------*/
+void applyPreset(const Preset &preset)
+{
+  fftProcessor.applyPreset(preset);
+  light.applyPreset(preset);
+}
+
+// Hand the preset list over to BLE reads
+void publishPresetList()
+{
+  char list[sizeof(presetList)];
+  size_t len = presetStore.format(list, sizeof(list));
+
+  portENTER_CRITICAL(&presetRequestMux);
+  memcpy(presetList, list, len);
+  presetListLength = len;
+  portEXIT_CRITICAL(&presetRequestMux);
+}
+
+// Apply a preset request from BLE; the store is saved here as flash writes stall both cores
+void handlePresetRequest()
+{
+  uint8_t request[sizeof(presetRequest)];
+  size_t length;
+
+  portENTER_CRITICAL(&presetRequestMux);
+  length = presetRequestLength;
+  memcpy(request, presetRequest, length);
+  presetRequestLength = 0;
+  portEXIT_CRITICAL(&presetRequestMux);
+
+  if (length == 0)
+    return;
+
+  if (length == sizeof(request))
+  {
+    Preset preset;
+    memcpy(&preset, request + 1, sizeof(preset));
+
+    if (!presetStore.setPreset(request[0], preset))
+    {
+      log_w("Rejected preset %d", request[0]);
+      return;
+    }
+  }
+
+  if (!presetStore.select(request[0]))
+  {
+    log_w("No preset %d", request[0]);
+    return;
+  }
+
+  applyPreset(presetStore.activePreset());
+  presetStore.save();
+  publishPresetList();
+}
+
+/*------------------------------------------------------------------------------
+  Overload
+  ----------------------------------------------------------------------------*/
+// Each level keeps the reductions of the levels below it
+void applyOverloadLevel(OverloadLevel level)
+{
+  fftProcessor.setDisplaySuspended(level >= OverloadLevel::NoDisplay);
+  light.setModifiersSuspended(level >= OverloadLevel::NoParticles);
+  light.setFrameDivider(level >= OverloadLevel::HalfLedRate ? 2 : 1);
+  fftProcessor.setBlockSizeBoost(level >= OverloadLevel::LargerBlock);
+
+  log_w("Overload level: %s", OverloadController::levelName(level));
+}
+
+void setup()
+{
+
 /*----------------------------------------------------------------------------*/
+  // Power management and serial first, the display is initialized in the background
+  M5.begin(false, true, true);
+  bootMilestone("M5 power and serial");
 
+#ifdef AUDIOVIS_RAW_CAPTURE
+  // Lossless audio needs about 60 kB/s, see tools/audio_record.py
+  Serial.updateBaudRate(1500000);
+  telemetry.begin(16384);
+#else
+  telemetry.begin();
+#endif
+
+  cpuLoad.begin();
+  showRecorder.begin();
+
+/*----------------------------------------------------------------------------*/
+  // Audio and LEDs come up first, they decide the time to the first reactive frame
   fftProcessor.setupI2Smic();
   fftProcessor.setupSpectrumAnalysis();
+  bootMilestone("audio ready");
+
   light.setupLedStrip();
+  bootMilestone("LEDs ready");
+
+  // The built-in defaults are derived from the compiled-in settings
+  Preset live = {};
+  fftProcessor.capturePreset(live);
+  light.capturePreset(live);
+
+  presetStore.load(live);
+  applyPreset(presetStore.activePreset());
+  publishPresetList();
+  bootMilestone("preset loaded");
+
+/*----------------------------------------------------------------------------*/
+  xTaskCreatePinnedToCore(displayInitTask, "displayInit", kInitTaskStackSize, nullptr, kInitTaskPriority, nullptr, kInitTaskCore);
+  xTaskCreatePinnedToCore(bleInitTask, "bleInit", kInitTaskStackSize, nullptr, kInitTaskPriority, nullptr, kInitTaskCore);
+  xTaskCreatePinnedToCore(storageInitTask, "storageInit", kInitTaskStackSize, nullptr, kInitTaskPriority, nullptr, kInitTaskCore);
 
   log_d("Setup successfully completed.");
   log_d("portTICK_PERIOD_MS: %d", portTICK_PERIOD_MS);
 
-  delay(500);
+  fftProcessor.printMemoryReport();
+  bootMilestone("setup done");
 }
 
 void loop()
 {
   fftProcessor.loop();
-  light.updateLedStrip(fftProcessor.getLightness(), fftProcessor.getBeatHit(), currentMode);
+
+  if (handleShowCommand(currentMode))
+  {
+    currentMode = "";
+  }
+
+  if (fftProcessor.isIdle())
+  {
+    light.updateIdle(currentMode);
+  }
+  else
+  {
+    const AnalysisFrame &live = fftProcessor.getFrame();
+
+    if (showRecorder.isRecording())
+    {
+      showRecorder.add(live);
+    }
+
+    // A playing show replaces the live bands and beats, the colours still follow the live chroma
+    const AnalysisFrame *show = showPlayer.update(micros(), live.isBeatHit);
+
+    light.updateLedStrip(show ? *show : live, fftProcessor.getChroma(), currentMode);
+    light.addCurrentMeasurement(fftProcessor.getCurrent());
+    stageProfiler.endFrame();
+
+    if (overload.update(stageProfiler.histogram(Stage::Frame).last(), stageProfiler.frameBudget(),
+                        fftProcessor.getQueuedBuffers()))
+    {
+      applyOverloadLevel(overload.level());
+    }
+
+    if (!isFirstFrameShown)
+    {
+      isFirstFrameShown = true;
+      bootMilestone("first reactive LED frame");
+      printBootReport();
+    }
+  }
+
   currentMode = "";
+
+  handlePresetRequest();
+
+  // Serial commands: 'p' prints the latency report, 'r' resets it, 't' toggles binary telemetry,
+  // 'm' prints the memory report, 'w' the power report, 'b' the boot milestones,
+  // 'f' benchmarks the FFT sizes, 'n' switches to the next FFT size, 'd' prints the overload level,
+  // 'c' benchmarks the show codec, 'k' the particle system
+  if (Serial.available())
+  {
+    char cmd = Serial.read();
+
+    if (cmd == 'p')
+    {
+      size_t len = stageProfiler.format(statsReport, sizeof(statsReport));
+      cpuLoad.format(statsReport + len, sizeof(statsReport) - len);
+      Serial.print(statsReport);
+    }
+    else if (cmd == 'r')
+    {
+      stageProfiler.reset();
+    }
+    else if (cmd == 't')
+    {
+      telemetry.setEnabled(!telemetry.isEnabled());
+    }
+    else if (cmd == 'm')
+    {
+      fftProcessor.printMemoryReport();
+    }
+    else if (cmd == 'w')
+    {
+      fftProcessor.printPowerReport();
+    }
+    else if (cmd == 'b')
+    {
+      printBootReport();
+    }
+    else if (cmd == 'f')
+    {
+      fftProcessor.printFftBenchmark();
+    }
+    else if (cmd == 'n')
+    {
+      uint8_t sizeLog2 = fftProcessor.getFftSize() + 1;
+      fftProcessor.setFftSize(sizeLog2 > 12 ? 9 : sizeLog2);
+    }
+    else if (cmd == 'd')
+    {
+      overload.format(statsReport, sizeof(statsReport));
+      Serial.print(statsReport);
+    }
+    else if (cmd == 'c')
+    {
+      printShowBenchmark();
+    }
+    else if (cmd == 'k')
+    {
+      light.printParticleBenchmark();
+    }
+  }
+
   M5.update();
-  if(M5.BtnB.wasPressed()) {
-    int *lightness = fftProcessor.getLightness();
-    for (uint8_t i = 0; i < sizeof(lightness); i++)
+
+  // ButtonA toggles binary telemetry like 't', ButtonB prints the current frame unless binary frames are streamed
+  if (M5.BtnA.wasPressed())
+  {
+    telemetry.setEnabled(!telemetry.isEnabled());
+  }
+
+  if(M5.BtnB.wasPressed() && !telemetry.isStreaming()) {
+    const AnalysisFrame &frame = fftProcessor.getFrame();
+    for (uint8_t i = 0; i < AnalysisFrame::kBandCount; i++)
     {
-        Serial.printf("LED %i = %i\n", i, lightness[i]);
+        Serial.printf("LED %i = %i\n", i, frame.lightness[i]);
     }
+    Serial.printf("RMS %.3f, peak %.3f, centroid %.0f Hz, rolloff %.0f Hz, flux %.3f, flatness %.3f\n",
+                  frame.rms, frame.peak, frame.centroidHz, frame.rolloffHz, frame.flux, frame.flatness);
+    light.printEffectStats();
   }
 }
\ No newline at end of file
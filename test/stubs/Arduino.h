@@ -0,0 +1,44 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/*
+    Minimal stand-in for the Arduino core, so the hardware independent units
+    can be compiled and tested on the host (pio test -e native). Time is a
+    simulated clock that tests and mocks advance explicitly.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#define log_e(format, ...) printf("[E] " format "\n", ##__VA_ARGS__)
+#define log_w(format, ...) printf("[W] " format "\n", ##__VA_ARGS__)
+#define log_i(format, ...) ((void)0)
+#define log_d(format, ...) ((void)0)
+#define log_v(format, ...) ((void)0)
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+// Simulated time [us]
+inline uint32_t &hostMicros()
+{
+    static uint32_t micros = 0;
+    return micros;
+}
+
+inline void hostAdvanceMicros(uint32_t delta) { hostMicros() += delta; }
+
+inline unsigned long micros() { return hostMicros(); }
+inline unsigned long millis() { return hostMicros() / 1000; }
+
+#endif
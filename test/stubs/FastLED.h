@@ -0,0 +1,134 @@
+#ifndef HOST_FASTLED_H
+#define HOST_FASTLED_H
+
+/*
+    Host stand-in for the parts of FastLED used by the tested units. Instead of
+    driving pins, FastLED.show() serializes every controller's pixels into the
+    byte stream the strip would receive and advances the simulated clock by the
+    transmit time. Like the RMT driver on the ESP32, all controllers transmit
+    at once, so a show takes as long as the longest one.
+*/
+
+#include <Arduino.h>
+#include <vector>
+
+struct CRGB
+{
+    union
+    {
+        struct
+        {
+            uint8_t r;
+            uint8_t g;
+            uint8_t b;
+        };
+        uint8_t raw[3];
+    };
+
+    enum HTMLColorCode : uint32_t
+    {
+        Black = 0x000000,
+        White = 0xFFFFFF
+    };
+
+    CRGB() = default;
+    CRGB(uint8_t ir, uint8_t ig, uint8_t ib) : r(ir), g(ig), b(ib) {}
+    CRGB(HTMLColorCode code) : r(code >> 16), g((code >> 8) & 0xFF), b(code & 0xFF) {}
+
+    bool operator==(const CRGB &o) const { return r == o.r && g == o.g && b == o.b; }
+    bool operator!=(const CRGB &o) const { return !(*this == o); }
+};
+
+struct CRGBPalette256
+{
+    CRGB entries[256];
+
+    CRGB &operator[](uint8_t i) { return entries[i]; }
+    const CRGB &operator[](uint8_t i) const { return entries[i]; }
+};
+
+inline uint8_t scale8(uint8_t i, uint8_t scale) { return ((uint16_t)i * (1 + scale)) >> 8; }
+
+inline uint8_t blend8(uint8_t a, uint8_t b, uint8_t amountOfB)
+{
+    uint16_t partial = (a << 8) | b;
+    partial += b * amountOfB;
+    partial -= a * amountOfB;
+    return partial >> 8;
+}
+
+inline CRGB blend(const CRGB &p1, const CRGB &p2, uint8_t amountOfP2)
+{
+    return CRGB(blend8(p1.r, p2.r, amountOfP2), blend8(p1.g, p2.g, amountOfP2), blend8(p1.b, p2.b, amountOfP2));
+}
+
+template <uint8_t DATA_PIN>
+class NEOPIXEL
+{
+};
+
+/* ----- WS2812 timing of the simulated strips ----- */
+const uint32_t kHostNanosPerLed = 30000; // 24 bits at 800 kHz
+const uint32_t kHostResetMicros = 300;
+
+struct HostLedController
+{
+    uint8_t pin;
+    const CRGB *leds;
+    uint16_t length;
+    std::vector<uint8_t> stream; // Bytes sent by the last show, GRB order as for WS2812
+    uint32_t transmitMicros;     // Duration of the last show on this pin
+};
+
+class CFastLED
+{
+private:
+    std::vector<HostLedController> controllers_;
+    uint8_t brightness_ = 255;
+
+public:
+    template <template <uint8_t> class CHIPSET, uint8_t DATA_PIN>
+    void addLeds(CRGB *leds, int length)
+    {
+        controllers_.push_back({DATA_PIN, leds, (uint16_t)length, {}, 0});
+    }
+
+    void setBrightness(uint8_t brightness) { brightness_ = brightness; }
+
+    void show()
+    {
+        uint32_t longestMicros = 0;
+
+        for (HostLedController &controller : controllers_)
+        {
+            controller.stream.clear();
+
+            for (uint16_t i = 0; i < controller.length; i++)
+            {
+                const CRGB &c = controller.leds[i];
+                controller.stream.push_back(scale8(c.g, brightness_));
+                controller.stream.push_back(scale8(c.r, brightness_));
+                controller.stream.push_back(scale8(c.b, brightness_));
+            }
+
+            controller.transmitMicros = (controller.length * kHostNanosPerLed) / 1000 + kHostResetMicros;
+            longestMicros = max(longestMicros, controller.transmitMicros);
+        }
+
+        hostAdvanceMicros(longestMicros);
+    }
+
+    // Test access
+    const std::vector<HostLedController> &controllers() const { return controllers_; }
+    void reset() { controllers_.clear(); }
+};
+
+inline CFastLED &hostFastLED()
+{
+    static CFastLED fastLED;
+    return fastLED;
+}
+
+static CFastLED &FastLED = hostFastLED();
+
+#endif
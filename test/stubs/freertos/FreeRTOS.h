@@ -0,0 +1,15 @@
+#ifndef FREERTOS_STUB_H
+#define FREERTOS_STUB_H
+
+// Host stand-in for the FreeRTOS types used by the hardware independent units
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef SEMPHR_STUB_H
+#define SEMPHR_STUB_H
+
+// Host stand-in for FreeRTOS mutexes, on std::mutex so writers on several threads really block each other
+#include "FreeRTOS.h"
+#include <mutex>
+
+typedef std::mutex *SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new std::mutex(); }
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t)
+{
+    mutex->lock();
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    mutex->unlock();
+    return pdTRUE;
+}
+
+#endif
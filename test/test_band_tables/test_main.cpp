@@ -0,0 +1,363 @@
+#include <unity.h>
+#include <atomic>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include "BandTable.h"
+#include "StageProfiler.h"
+
+// 2048 point FFT at 44.1 kHz
+const float kFreqStep = 44100.0f / 2048;
+const uint16_t kBinCount = 1025;
+const uint8_t kBandCount = BandTable::kBandCount;
+
+BandTables tables;
+float endHz[2][kBandCount]; // Two band layouts, the writer switches between them
+
+// The default bands of FFTProcessor.cpp, from 20 Hz
+const float kDeviceStartHz = 20.0f;
+const float kDeviceEndHz[kBandCount] = {
+    66, 112, 158, 204, 250, 275, 300, 325, 350, 375, 400, 425, 450, 475, 500, 546,
+    593, 640, 687, 734, 781, 828, 875, 921, 968, 1015, 1062, 1109, 1156, 1203, 1250, 1296,
+    1343, 1390, 1437, 1484, 1531, 1578, 1625, 1671, 1718, 1765, 1812, 1859, 1906, 1953, 2000, 2075,
+    2150, 2225, 2300, 2375, 2450, 2525, 2600, 2675, 2750, 2825, 2900, 2975, 3050, 3125, 3200, 20000};
+
+const uint16_t kMaxBinCount = 2049;
+float spectrum[kMaxBinCount];
+
+void setUp()
+{
+    // Logarithmic bands from 40 Hz, the second layout a little wider
+    for (uint8_t band = 0; band < kBandCount; band++)
+    {
+        endHz[0][band] = 40.0f * powf(2.0f, (band + 1) * 8.5f / kBandCount);
+        endHz[1][band] = 40.0f * powf(2.0f, (band + 1) * 8.8f / kBandCount);
+    }
+}
+
+void tearDown() {}
+
+// Every gain of generation g is g; every fourth generation has the first layout, the others the second
+static bool isConsistent(const BandTable &table, float generation)
+{
+    const float *edges = endHz[((uint32_t)generation % 4 == 0) ? 0 : 1];
+
+    for (uint8_t band = 0; band < kBandCount; band++)
+    {
+        if (table.gain[band] != generation || table.endHz[band] != edges[band])
+            return false;
+    }
+
+    return true;
+}
+
+void test_frame_never_mixes_tables()
+{
+    const uint32_t kGenerations = 4000;
+    float gain[kBandCount];
+
+    for (uint8_t band = 0; band < kBandCount; band++)
+    {
+        gain[band] = 0.0f;
+    }
+
+    TEST_ASSERT_TRUE(tables.begin(0.0f, kFreqStep, kBinCount));
+    TEST_ASSERT_TRUE(tables.update(endHz[0], gain));
+
+    std::atomic<bool> isWriting(true);
+    uint32_t frames = 0;
+    uint32_t changes = 0;
+    uint32_t mixedFrames = 0;
+
+    // Replays frames like FFTProcessor::loop: acquire, use the table several times, release
+    std::thread replay([&]() {
+        float lastGeneration = -1.0f;
+
+        while (isWriting.load())
+        {
+            const BandTable &table = tables.acquire();
+            float generation = table.gain[0];
+            bool isFrameConsistent = true;
+
+            for (uint8_t pass = 0; pass < 8; pass++)
+            {
+                isFrameConsistent = isConsistent(table, generation) && isFrameConsistent;
+            }
+
+            tables.release();
+
+            if (!isFrameConsistent)
+                mixedFrames++;
+
+            if (generation != lastGeneration)
+                changes++;
+
+            lastGeneration = generation;
+            frames++;
+        }
+    });
+
+    // Swaps tables as fast as it can, with new gains and layouts or new gains only
+    std::thread writer([&]() {
+        for (uint32_t generation = 1; generation <= kGenerations; generation++)
+        {
+            for (uint8_t band = 0; band < kBandCount; band++)
+            {
+                gain[band] = generation;
+            }
+
+            if (generation % 4 == 2)
+            {
+                tables.updateGains(gain); // Keeps the second layout of the generation before
+            }
+            else
+            {
+                tables.update(endHz[(generation % 4 == 0) ? 0 : 1], gain);
+            }
+        }
+
+        isWriting.store(false);
+    });
+
+    writer.join();
+    replay.join();
+
+    char report[96];
+    snprintf(report, sizeof(report), "%u frames, %u table changes seen, %u swaps", frames, changes, tables.swapCount());
+    TEST_MESSAGE(report);
+
+    TEST_ASSERT_EQUAL(0, mixedFrames);
+    TEST_ASSERT_GREATER_THAN(1, changes);
+    TEST_ASSERT_EQUAL(kGenerations + 1, tables.swapCount());
+}
+
+// What a BLE client may write: every update is checked before anything is converted or published
+void test_invalid_updates_are_rejected()
+{
+    BandTables checked;
+    float gain[kBandCount];
+    float edges[kBandCount];
+
+    for (uint8_t band = 0; band < kBandCount; band++)
+    {
+        gain[band] = 1.0f;
+    }
+
+    TEST_ASSERT_TRUE(checked.begin(0.0f, kFreqStep, kBinCount));
+    TEST_ASSERT_TRUE(checked.update(endHz[0], gain));
+    TEST_ASSERT_EQUAL(1, checked.swapCount());
+
+    const float badGains[] = {NAN, INFINITY, -INFINITY, -0.5f};
+
+    for (uint8_t i = 0; i < sizeof(badGains) / sizeof(badGains[0]); i++)
+    {
+        gain[20] = badGains[i];
+        TEST_ASSERT_FALSE(checked.update(endHz[1], gain));
+        TEST_ASSERT_FALSE(checked.updateGains(gain));
+    }
+
+    gain[20] = 1.0f;
+
+    const float badEdges[] = {NAN, INFINITY, -INFINITY, 0.0f, 30000.0f};
+
+    for (uint8_t i = 0; i < sizeof(badEdges) / sizeof(badEdges[0]); i++)
+    {
+        memcpy(edges, endHz[1], sizeof(edges));
+        edges[i == 4 ? kBandCount - 1 : 30] = badEdges[i];
+        TEST_ASSERT_FALSE(checked.update(edges, gain));
+    }
+
+    // Edges that stay the same or go down
+    memcpy(edges, endHz[1], sizeof(edges));
+    edges[31] = edges[30];
+    TEST_ASSERT_FALSE(checked.update(edges, gain));
+
+    edges[31] = edges[30] - 1.0f;
+    TEST_ASSERT_FALSE(checked.update(edges, gain));
+
+    // The first edge must be above the start of the first band
+    memcpy(edges, endHz[1], sizeof(edges));
+    edges[0] = 0.0f;
+    TEST_ASSERT_FALSE(checked.update(edges, gain));
+
+    // Nothing was published, the first table is still in place
+    TEST_ASSERT_EQUAL(1, checked.swapCount());
+    TEST_ASSERT_EQUAL_FLOAT(endHz[0][30], checked.current().endHz[30]);
+
+    // Zero gains mute a band and are fine
+    gain[20] = 0.0f;
+    TEST_ASSERT_TRUE(checked.updateGains(gain));
+    TEST_ASSERT_EQUAL(2, checked.swapCount());
+}
+
+// The band magnitude before the filterbank: the maximum bin inside the band
+static float maxOverBand(const BandTable &table, uint8_t band, const float *magnitude)
+{
+    float value = 0.0f;
+
+    for (uint16_t binIdx = table.binIdxStart[band]; binIdx <= table.binIdxEnd[band]; binIdx++)
+    {
+        if (magnitude[binIdx] > value)
+            value = magnitude[binIdx];
+    }
+
+    return value;
+}
+
+// Bin with the highest weight of a filter
+static uint16_t peakBin(const BandTable &table, uint8_t band)
+{
+    const uint8_t *weight = table.weights + table.filterOffset[band];
+    uint16_t peak = 0;
+
+    for (uint16_t i = 1; i < table.filterLength[band]; i++)
+    {
+        if (weight[i] > weight[peak])
+            peak = i;
+    }
+
+    return table.filterStart[band] + peak;
+}
+
+// A tone at the peak of a filter reads its own level in every band, from 1 bin to 780 bins wide
+void test_tone_response_does_not_depend_on_width()
+{
+    const float kTone = 1000.0f;
+    float gain[kBandCount];
+
+    for (uint8_t band = 0; band < kBandCount; band++)
+    {
+        gain[band] = 1.0f;
+    }
+
+    BandTables device;
+    TEST_ASSERT_TRUE(device.begin(kDeviceStartHz, kFreqStep, kBinCount));
+    TEST_ASSERT_TRUE(device.update(kDeviceEndHz, gain));
+
+    const BandTable &table = device.current();
+    TEST_ASSERT_GREATER_THAN(700, table.filterLength[kBandCount - 1]);
+
+    for (uint8_t band = 0; band < kBandCount; band++)
+    {
+        uint16_t bin = peakBin(table, band);
+
+        memset(spectrum, 0, sizeof(spectrum));
+        spectrum[bin] = kTone;
+
+        TEST_ASSERT_FLOAT_WITHIN(0.01f * kTone, kTone, table.magnitude(band, spectrum));
+
+        // The same level as the maximum over the band read
+        if (bin >= table.binIdxStart[band] && bin <= table.binIdxEnd[band])
+        {
+            TEST_ASSERT_FLOAT_WITHIN(0.01f * kTone, maxOverBand(table, band, spectrum), table.magnitude(band, spectrum));
+        }
+
+        // The neighbours only see the flank of their filters
+        for (uint8_t other = 0; other < kBandCount; other++)
+        {
+            TEST_ASSERT_TRUE(table.magnitude(other, spectrum) <= table.magnitude(band, spectrum));
+        }
+    }
+
+    // A tone between two centers fades from one band into the next, neither exceeds the tone
+    uint8_t band = 40;
+    uint16_t bin = (peakBin(table, band) + peakBin(table, band + 1)) / 2;
+
+    memset(spectrum, 0, sizeof(spectrum));
+    spectrum[bin] = kTone;
+
+    float lower = table.magnitude(band, spectrum);
+    float upper = table.magnitude(band + 1, spectrum);
+
+    TEST_ASSERT_TRUE(lower > 0.2f * kTone && lower < kTone);
+    TEST_ASSERT_TRUE(upper > 0.2f * kTone && upper < kTone);
+}
+
+/*
+    Band stage of FFTProcessor::loop for the default bands, recorded with the
+    stage profiler:
+    - before: the maximum over the bins of each band
+    - after: the sparse dot product of each triangular filter
+*/
+void test_benchmark()
+{
+    const uint16_t kFrames = 5000;
+    float gain[kBandCount];
+    uint32_t seed = 1;
+
+    for (uint8_t band = 0; band < kBandCount; band++)
+    {
+        gain[band] = 1.0f;
+    }
+
+    for (uint16_t sampleCount = 1024; sampleCount <= 4096; sampleCount *= 2)
+    {
+        BandTables device;
+        uint16_t binCount = sampleCount / 2 + 1;
+
+        TEST_ASSERT_TRUE(device.begin(kDeviceStartHz, 44100.0f / sampleCount, binCount));
+        TEST_ASSERT_TRUE(device.update(kDeviceEndHz, gain));
+
+        const BandTable &table = device.current();
+        uint32_t weightCount = table.filterOffset[kBandCount - 1] + table.filterLength[kBandCount - 1];
+
+        StageProfiler before;
+        StageProfiler after;
+        uint64_t beforeTicks = 0;
+        uint64_t afterTicks = 0;
+        float checksum = 0.0f;
+
+        for (uint16_t frame = 0; frame < kFrames; frame++)
+        {
+            // A new spectrum each frame, as the averaged magnitudes change
+            for (uint16_t i = 0; i < binCount; i++)
+            {
+                seed = seed * 1664525 + 1013904223;
+                spectrum[i] = (seed >> 8) * (1.0f / (1 << 24));
+            }
+
+            uint32_t start = before.now();
+
+            for (uint8_t band = 0; band < kBandCount; band++)
+            {
+                checksum += maxOverBand(table, band, spectrum);
+            }
+
+            beforeTicks += before.record(Stage::Bands, start) - start;
+
+            start = after.now();
+
+            for (uint8_t band = 0; band < kBandCount; band++)
+            {
+                checksum += table.magnitude(band, spectrum);
+            }
+
+            afterTicks += after.record(Stage::Bands, start) - start;
+        }
+
+        const LatencyHistogram &beforeHistogram = before.histogram(Stage::Bands);
+        const LatencyHistogram &afterHistogram = after.histogram(Stage::Bands);
+
+        TEST_ASSERT_EQUAL(kFrames, beforeHistogram.count());
+        TEST_ASSERT_EQUAL(kFrames, afterHistogram.count());
+        TEST_ASSERT_TRUE(checksum > 0.0f);
+
+        char report[160];
+        snprintf(report, sizeof(report),
+                 "%4u samples: max per band %.2f us (p99 %u), filters %.2f us (p99 %u), %u weights",
+                 sampleCount, (double)beforeTicks / kFrames, beforeHistogram.percentile(99),
+                 (double)afterTicks / kFrames, afterHistogram.percentile(99), weightCount);
+        TEST_MESSAGE(report);
+    }
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_frame_never_mixes_tables);
+    RUN_TEST(test_invalid_updates_are_rejected);
+    RUN_TEST(test_tone_response_does_not_depend_on_width);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
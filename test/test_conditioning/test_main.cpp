@@ -0,0 +1,239 @@
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include <stdio.h>
+#include "SampleConditioning.h"
+#include "StageProfiler.h"
+
+// As in FFTProcessor.cpp: 512 sample DMA buffers and blocks of 512 to 4096 samples
+const uint16_t kDmaSamples = 512;
+const uint8_t kDmaBufferCount = 6;
+const uint16_t kMaxBlockSamples = 4096;
+const float kScale = 1.0f / 32767;
+
+// The aliased analysis arena: samples of a block of N in the second half of the first 4N bytes
+union Arena
+{
+    float real[kMaxBlockSamples];
+    int16_t raw[2 * kMaxBlockSamples];
+};
+
+Arena arena;
+float imag[kMaxBlockSamples];
+float expectedReal[kMaxBlockSamples];
+float expectedImag[kMaxBlockSamples];
+int16_t readBuffer[kMaxBlockSamples]; // Separate i2s_read target of the conditioning before the arena
+
+/*
+    Stand-in for the I2S driver: a ring of DMA buffers holding a tone with DC
+    offset and noise. read() hands out the next buffer like i2s_read, by copying
+    it out of the ring, and the DMA refills the buffer.
+*/
+class HostI2s
+{
+private:
+    int16_t ring_[kDmaBufferCount][kDmaSamples];
+    uint8_t next_ = 0;
+    uint32_t phase_ = 0;
+    uint32_t seed_ = 1;
+
+    void fill(int16_t *buffer)
+    {
+        for (uint16_t i = 0; i < kDmaSamples; i++, phase_++)
+        {
+            seed_ = seed_ * 1664525 + 1013904223;
+            float tone = 8000.0f * sinf(6.2831853f * 1000.0f * phase_ / 44100.0f);
+            buffer[i] = (int16_t)(-1200.0f + tone) + (int16_t)((seed_ >> 24) & 0xFF) - 128;
+        }
+    }
+
+public:
+    HostI2s()
+    {
+        for (uint8_t i = 0; i < kDmaBufferCount; i++)
+        {
+            fill(ring_[i]);
+        }
+    }
+
+    void read(int16_t *buffer)
+    {
+        memcpy(buffer, ring_[next_], sizeof(ring_[next_]));
+        fill(ring_[next_]);
+        next_ = (next_ + 1) % kDmaBufferCount;
+    }
+};
+
+// The conditioning before per buffer processing: a sum pass for the DC offset of this block, then the conversion
+static void conditionTwoPass(const int16_t *raw, float *real, float *imag, uint16_t count, BlockStats &stats)
+{
+    int32_t sum = 0;
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        sum += raw[i];
+    }
+
+    conditionSamples(raw, real, imag, count, sum / count, kScale, stats);
+}
+
+static int16_t *blockSamples(uint16_t sampleCount)
+{
+    return arena.raw + sampleCount;
+}
+
+void setUp()
+{
+    memset(&arena, 0, sizeof(arena));
+}
+
+void tearDown() {}
+
+void test_aliased_arena_matches_separate_buffers()
+{
+    HostI2s i2s;
+    const uint16_t sampleCount = 2048;
+    int16_t *samples = blockSamples(sampleCount);
+
+    for (uint16_t offset = 0; offset < sampleCount; offset += kDmaSamples)
+    {
+        i2s.read(samples + offset);
+    }
+
+    memcpy(readBuffer, samples, sampleCount * sizeof(int16_t));
+
+    BlockStats expected;
+    conditionSamples(readBuffer, expectedReal, expectedImag, sampleCount, -1200, kScale, expected);
+
+    // In place, buffer by buffer as in FFTProcessor::loop
+    BlockStats stats;
+
+    for (uint16_t offset = 0; offset < sampleCount; offset += kDmaSamples)
+    {
+        conditionSamples(samples + offset, arena.real + offset, imag + offset, kDmaSamples, -1200, kScale, stats);
+    }
+
+    TEST_ASSERT_EQUAL_MEMORY(expectedReal, arena.real, sampleCount * sizeof(float));
+    TEST_ASSERT_EQUAL(expected.sum, stats.sum);
+    TEST_ASSERT_TRUE(expected.sumSquares == stats.sumSquares);
+    TEST_ASSERT_EQUAL(expected.peak, stats.peak);
+}
+
+void test_dc_offset_from_previous_block()
+{
+    HostI2s i2s;
+    const uint16_t sampleCount = 4096;
+    int16_t *samples = blockSamples(sampleCount);
+    int16_t dcOffset = 0;
+
+    for (uint8_t block = 0; block < 3; block++)
+    {
+        BlockStats stats;
+
+        for (uint16_t offset = 0; offset < sampleCount; offset += kDmaSamples)
+        {
+            i2s.read(samples + offset);
+            conditionSamples(samples + offset, arena.real + offset, imag + offset, kDmaSamples, dcOffset, kScale, stats);
+        }
+
+        dcOffset = stats.sum / sampleCount;
+    }
+
+    // Apart from the part of a tone period at the end of the block, the estimate is the offset of the microphone
+    TEST_ASSERT_INT_WITHIN(40, -1200, dcOffset);
+
+    // So the converted block has no DC left either
+    float mean = 0.0f;
+
+    for (uint16_t i = 0; i < sampleCount; i++)
+    {
+        mean += arena.real[i];
+    }
+
+    TEST_ASSERT_FLOAT_WITHIN(40 * kScale, 0.0f, mean / sampleCount);
+}
+
+/*
+    Conditioning latency after the last DMA buffer of a block has arrived,
+    recorded with the stage profiler the way FFTProcessor::loop does:
+    - before: the block is read into a separate buffer, then a sum pass and
+      the conversion run over the whole block
+    - after: each buffer is converted in the arena as it arrives, only the
+      last one is left when the block is complete
+*/
+void test_benchmark()
+{
+    const uint16_t kBlocks = 2000;
+    HostI2s i2s;
+
+    for (uint16_t sampleCount = 512; sampleCount <= kMaxBlockSamples; sampleCount *= 2)
+    {
+        StageProfiler before;
+        StageProfiler after;
+        uint64_t beforeTicks = 0;
+        uint64_t afterTicks = 0;
+        uint64_t hiddenTicks = 0;
+        int16_t *samples = blockSamples(sampleCount);
+        int16_t dcOffset = 0;
+
+        for (uint16_t block = 0; block < kBlocks; block++)
+        {
+            BlockStats stats;
+
+            for (uint16_t offset = 0; offset < sampleCount; offset += kDmaSamples)
+            {
+                i2s.read(readBuffer + offset);
+            }
+
+            uint32_t start = before.now();
+            conditionTwoPass(readBuffer, expectedReal, expectedImag, sampleCount, stats);
+            beforeTicks += before.record(Stage::Conditioning, start) - start;
+
+            stats = BlockStats();
+
+            for (uint16_t offset = 0; offset + kDmaSamples < sampleCount; offset += kDmaSamples)
+            {
+                i2s.read(samples + offset);
+                start = after.now();
+                conditionSamples(samples + offset, arena.real + offset, imag + offset, kDmaSamples, dcOffset, kScale, stats);
+                hiddenTicks += after.now() - start;
+            }
+
+            uint16_t last = sampleCount - kDmaSamples;
+            i2s.read(samples + last);
+            start = after.now();
+            conditionSamples(samples + last, arena.real + last, imag + last, kDmaSamples, dcOffset, kScale, stats);
+            afterTicks += after.record(Stage::Conditioning, start) - start;
+
+            dcOffset = stats.sum / sampleCount;
+        }
+
+        const LatencyHistogram &beforeHistogram = before.histogram(Stage::Conditioning);
+        const LatencyHistogram &afterHistogram = after.histogram(Stage::Conditioning);
+
+        TEST_ASSERT_EQUAL(kBlocks, beforeHistogram.count());
+        TEST_ASSERT_EQUAL(kBlocks, afterHistogram.count());
+
+        char report[160];
+        snprintf(report, sizeof(report),
+                 "%4u samples: before %.2f us (p99 %u), after %.2f us (p99 %u), %.2f us hidden behind the I2S wait",
+                 sampleCount, (double)beforeTicks / kBlocks, beforeHistogram.percentile(99),
+                 (double)afterTicks / kBlocks, afterHistogram.percentile(99), (double)hiddenTicks / kBlocks);
+        TEST_MESSAGE(report);
+
+        // Only the last of 8 buffers is left at 4096 samples
+        if (sampleCount == kMaxBlockSamples)
+        {
+            TEST_ASSERT_TRUE(afterTicks < beforeTicks);
+        }
+    }
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_aliased_arena_matches_separate_buffers);
+    RUN_TEST(test_dc_offset_from_previous_block);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,117 @@
+#include <unity.h>
+#include "LedOutput.h"
+
+/* Frame buffer shared by three segments, as in LightingProcessor */
+const uint16_t kFrameSize = 10 + 139 + 40;
+CRGB frame[kFrameSize];
+
+const LedSegment kSegments[] = {
+    {25, 10, 0, false, EffectId::Default, 0, MatrixWiring::Progressive},
+    {26, 139, 10, false, EffectId::Default, 0, MatrixWiring::Progressive},
+    {32, 40, 149, true, EffectId::Default, 0, MatrixWiring::Progressive},
+};
+
+void setUp()
+{
+    FastLED.reset();
+    FastLED.setBrightness(255);
+
+    for (uint16_t i = 0; i < kFrameSize; i++)
+    {
+        frame[i] = CRGB(i & 0xFF, (i * 7) & 0xFF, 255 - (i & 0xFF));
+    }
+}
+
+void tearDown() {}
+
+void test_byte_stream_per_segment()
+{
+    LedOutput output;
+
+    for (const LedSegment &segment : kSegments)
+    {
+        TEST_ASSERT_TRUE(output.addSegment(segment, frame, kFrameSize));
+    }
+
+    output.show();
+
+    const std::vector<HostLedController> &controllers = FastLED.controllers();
+    TEST_ASSERT_EQUAL(3, controllers.size());
+
+    for (uint8_t s = 0; s < 3; s++)
+    {
+        const LedSegment &segment = kSegments[s];
+        const HostLedController &controller = controllers[s];
+
+        TEST_ASSERT_EQUAL(segment.pin, controller.pin);
+        TEST_ASSERT_EQUAL(3 * segment.length, controller.stream.size());
+
+        // Each pin carries exactly its own slice of the frame buffer, green first
+        for (uint16_t i = 0; i < segment.length; i++)
+        {
+            const CRGB &c = frame[segment.offset + i];
+            TEST_ASSERT_EQUAL(c.g, controller.stream[3 * i]);
+            TEST_ASSERT_EQUAL(c.r, controller.stream[3 * i + 1]);
+            TEST_ASSERT_EQUAL(c.b, controller.stream[3 * i + 2]);
+        }
+    }
+}
+
+/*
+    The host stub advances the clock by the longest controller, so this only
+    checks the bookkeeping; whether the pins really transmit at the same time
+    is measured on the device by the "show" stage.
+*/
+void test_show_time_bookkeeping()
+{
+    LedOutput output;
+
+    for (const LedSegment &segment : kSegments)
+    {
+        TEST_ASSERT_TRUE(output.addSegment(segment, frame, kFrameSize));
+    }
+
+    // 30 us per LED of the longest segment (139 LEDs) plus the 300 us latch
+    TEST_ASSERT_EQUAL(139 * 30 + 300, output.expectedShowMicros());
+    output.show();
+    TEST_ASSERT_EQUAL(output.expectedShowMicros(), output.lastShowMicros);
+
+    output.show();
+    TEST_ASSERT_EQUAL(output.lastShowMicros, output.maxShowMicros);
+}
+
+void test_rejects_invalid_segments()
+{
+    LedOutput output;
+
+    TEST_ASSERT_TRUE(output.addSegment(kSegments[0], frame, kFrameSize));
+
+    // Same pin again
+    LedSegment segment = kSegments[1];
+    segment.pin = kSegments[0].pin;
+    TEST_ASSERT_FALSE(output.addSegment(segment, frame, kFrameSize));
+
+    // No controller for this pin
+    segment.pin = 27;
+    TEST_ASSERT_FALSE(output.addSegment(segment, frame, kFrameSize));
+
+    // Past the end of the frame buffer
+    segment = kSegments[2];
+    segment.length = 41;
+    TEST_ASSERT_FALSE(output.addSegment(segment, frame, kFrameSize));
+
+    segment.length = 0;
+    TEST_ASSERT_FALSE(output.addSegment(segment, frame, kFrameSize));
+
+    TEST_ASSERT_EQUAL(1, output.segmentCount());
+    TEST_ASSERT_EQUAL(1, FastLED.controllers().size());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_byte_stream_per_segment);
+    RUN_TEST(test_show_time_bookkeeping);
+    RUN_TEST(test_rejects_invalid_segments);
+    return UNITY_END();
+}
@@ -0,0 +1,97 @@
+#include <unity.h>
+#include <chrono>
+#include "Particles.h"
+
+const uint16_t kNumLeds = 139;
+CRGB leds[kNumLeds];
+ParticleSystem particles;
+PowerMeter power;
+
+void setUp()
+{
+    memset(leds, 0, sizeof(leds));
+    particles.clear();
+    power.reset();
+}
+
+void tearDown() {}
+
+void test_pool_capacity()
+{
+    for (uint16_t i = 0; i < ParticleSystem::kCapacity; i++)
+    {
+        TEST_ASSERT_TRUE(particles.spawn(i << 8, 0, 255, 1));
+    }
+
+    TEST_ASSERT_FALSE(particles.spawn(0, 0, 255, 1));
+    TEST_ASSERT_EQUAL(ParticleSystem::kCapacity, particles.count());
+
+    // A particle without life is never spawned
+    particles.clear();
+    TEST_ASSERT_FALSE(particles.spawn(0, 0, 0, 1));
+    TEST_ASSERT_EQUAL(0, particles.count());
+}
+
+void test_lifetime_and_culling()
+{
+    // Lives 255 / 51 = 5 frames, the second one leaves the strip after 2 frames
+    particles.spawn(10 << 8, 0, 255, 51);
+    particles.spawn((kNumLeds - 2) << 8, 256, 255, 1);
+
+    uint16_t counts[6];
+
+    for (uint8_t frame = 0; frame < 6; frame++)
+    {
+        particles.updateAndRender(leds, kNumLeds, power);
+        counts[frame] = particles.count();
+    }
+
+    TEST_ASSERT_EQUAL(2, counts[0]);
+    TEST_ASSERT_EQUAL(1, counts[1]);
+    TEST_ASSERT_EQUAL(1, counts[3]);
+    TEST_ASSERT_EQUAL(0, counts[4]);
+    TEST_ASSERT_EQUAL(0, counts[5]);
+}
+
+void test_render_splits_between_leds()
+{
+    // Half way between LED 20 and 21
+    particles.spawn((20 << 8) + 128, 0, 255, 1);
+    particles.updateAndRender(leds, kNumLeds, power);
+
+    TEST_ASSERT_GREATER_THAN(0, leds[20].r);
+    TEST_ASSERT_GREATER_THAN(0, leds[21].r);
+    TEST_ASSERT_INT_WITHIN(2, leds[20].r, leds[21].r);
+    TEST_ASSERT_EQUAL(0, leds[19].r);
+    TEST_ASSERT_EQUAL(0, leds[22].r);
+    TEST_ASSERT_EQUAL(pixelLoad(leds[20]) + pixelLoad(leds[21]), power.load());
+}
+
+void test_benchmark()
+{
+    const uint16_t kFrames = 2000;
+
+    // Warm up caches and the branch predictor
+    runParticleBenchmark(particles, leds, kNumLeds, 100);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint32_t updates = runParticleBenchmark(particles, leds, kNumLeds, kFrames);
+    double elapsedMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    TEST_ASSERT_EQUAL((uint32_t)kFrames * ParticleSystem::kCapacity, updates);
+
+    char report[160];
+    snprintf(report, sizeof(report), "%u particles on %u LEDs: %.2f us per frame, %.0f particle updates per ms",
+             ParticleSystem::kCapacity, kNumLeds, elapsedMicros / kFrames, updates * 1000.0 / elapsedMicros);
+    TEST_MESSAGE(report);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_pool_capacity);
+    RUN_TEST(test_lifetime_and_culling);
+    RUN_TEST(test_render_splits_between_leds);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
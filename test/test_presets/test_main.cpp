@@ -0,0 +1,200 @@
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "PresetRecord.h"
+
+PresetRecord slots[2];
+size_t slotLengths[2];
+
+// What the store writes: a record with a few presets, sealed and copied into a slot as the NVS entry
+static void writeSlot(uint8_t slot, uint32_t sequence, uint8_t count)
+{
+    PresetRecord record;
+    memset(&record, 0, sizeof(record));
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        Preset &preset = record.presets[i];
+        snprintf(preset.name, sizeof(preset.name), "show%u", i);
+
+        for (uint8_t band = 0; band < kPresetBandCount; band++)
+        {
+            preset.bandGain[band] = 1.0f + 0.01f * band;
+        }
+
+        preset.beatThreshold = 1.5f;
+        preset.sensitivityMax = 1000.0f;
+        preset.effect = i;
+    }
+
+    record.count = count;
+    record.active = count - 1;
+    record.sequence = sequence;
+    sealPresetRecord(record);
+
+    memcpy(&slots[slot], &record, sizeof(record));
+    slotLengths[slot] = sizeof(record);
+}
+
+// What the store reads back: the index of the newest valid slot, -1 means the defaults are loaded
+static int8_t loadSlots(PresetRecordStatus status[2])
+{
+    for (uint8_t slot = 0; slot < 2; slot++)
+    {
+        status[slot] = checkPresetRecord(slots[slot], slotLengths[slot]);
+    }
+
+    return newestPresetRecord(status, slots);
+}
+
+void setUp()
+{
+    memset(slots, 0, sizeof(slots));
+    slotLengths[0] = 0;
+    slotLengths[1] = 0;
+}
+
+void tearDown() {}
+
+void test_newest_record_wins()
+{
+    PresetRecordStatus status[2];
+
+    TEST_ASSERT_EQUAL(-1, loadSlots(status));
+    TEST_ASSERT_TRUE(status[0] == PresetRecordStatus::Missing);
+
+    writeSlot(0, 1, 3);
+    TEST_ASSERT_EQUAL(0, loadSlots(status));
+
+    writeSlot(1, 2, 4);
+    TEST_ASSERT_EQUAL(1, loadSlots(status));
+    TEST_ASSERT_EQUAL(4, slots[1].count);
+
+    // Across the wrap of the sequence number
+    writeSlot(0, 0xFFFFFFFF, 3);
+    writeSlot(1, 0, 4);
+    TEST_ASSERT_EQUAL(1, loadSlots(status));
+}
+
+void test_flipped_bytes_fall_back_to_last_good_record()
+{
+    PresetRecordStatus status[2];
+    uint8_t *bytes = (uint8_t *)&slots[1];
+
+    // Every byte covered by the CRC, one at a time: header, names, gains, settings and the CRC itself
+    for (size_t pos = 0; pos < offsetof(PresetRecord, crc) + 2; pos++)
+    {
+        writeSlot(0, 7, 3);
+        writeSlot(1, 8, 4);
+
+        bytes[pos] ^= 0x5A;
+
+        int8_t newest = loadSlots(status);
+
+        TEST_ASSERT_EQUAL(0, newest);
+        TEST_ASSERT_TRUE(status[1] != PresetRecordStatus::Valid);
+        TEST_ASSERT_EQUAL(3, slots[newest].count);
+    }
+
+    // Both damaged: defaults
+    writeSlot(0, 7, 3);
+    writeSlot(1, 8, 4);
+    ((uint8_t *)&slots[0])[100] ^= 0x01;
+    bytes[200] ^= 0x80;
+
+    TEST_ASSERT_EQUAL(-1, loadSlots(status));
+    TEST_ASSERT_TRUE(status[0] == PresetRecordStatus::Corrupt);
+    TEST_ASSERT_TRUE(status[1] == PresetRecordStatus::Corrupt);
+}
+
+void test_truncated_record_falls_back()
+{
+    PresetRecordStatus status[2];
+    const size_t lengths[] = {0, 1, 12, sizeof(PresetRecord) / 2, sizeof(PresetRecord) - 1};
+
+    for (uint8_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+        writeSlot(0, 7, 3);
+        writeSlot(1, 8, 4);
+
+        // A short read leaves the rest of the buffer as it was
+        memset((uint8_t *)&slots[1] + lengths[i], 0, sizeof(PresetRecord) - lengths[i]);
+        slotLengths[1] = lengths[i];
+
+        TEST_ASSERT_EQUAL(0, loadSlots(status));
+        TEST_ASSERT_TRUE(status[1] == PresetRecordStatus::Missing);
+    }
+
+    // The only record truncated: defaults
+    writeSlot(0, 7, 3);
+    slotLengths[0] = sizeof(PresetRecord) - 2;
+
+    TEST_ASSERT_EQUAL(-1, loadSlots(status));
+}
+
+void test_outdated_record_is_ignored()
+{
+    PresetRecordStatus status[2];
+
+    writeSlot(0, 7, 3);
+    writeSlot(1, 8, 4);
+
+    slots[1].version = kPresetRecordVersion - 1;
+
+    TEST_ASSERT_EQUAL(0, loadSlots(status));
+    TEST_ASSERT_TRUE(status[1] == PresetRecordStatus::Outdated);
+}
+
+void test_invalid_numbers_are_rejected()
+{
+    writeSlot(0, 1, 1);
+    const Preset good = slots[0].presets[0];
+    TEST_ASSERT_TRUE(isPresetValid(good));
+
+    Preset preset = good;
+    preset.bandGain[17] = NAN;
+    TEST_ASSERT_FALSE(isPresetValid(preset));
+
+    preset = good;
+    preset.bandGain[63] = -INFINITY;
+    TEST_ASSERT_FALSE(isPresetValid(preset));
+
+    preset = good;
+    preset.bandGain[0] = -1.0f;
+    TEST_ASSERT_FALSE(isPresetValid(preset));
+
+    preset = good;
+    preset.beatThreshold = INFINITY;
+    TEST_ASSERT_FALSE(isPresetValid(preset));
+
+    preset = good;
+    preset.sensitivityMax = NAN;
+    TEST_ASSERT_FALSE(isPresetValid(preset));
+
+    preset = good;
+    preset.sensitivityMax = 0.0f;
+    TEST_ASSERT_FALSE(isPresetValid(preset));
+
+    preset.sensitivityMax = -5.0f;
+    TEST_ASSERT_FALSE(isPresetValid(preset));
+
+    // A record with a CRC that matches but a NaN inside is not loaded either
+    PresetRecordStatus status[2];
+    slots[0].presets[0].beatThreshold = NAN;
+    sealPresetRecord(slots[0]);
+
+    TEST_ASSERT_EQUAL(-1, loadSlots(status));
+    TEST_ASSERT_TRUE(status[0] == PresetRecordStatus::Corrupt);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_newest_record_wins);
+    RUN_TEST(test_flipped_bytes_fall_back_to_last_good_record);
+    RUN_TEST(test_truncated_record_falls_back);
+    RUN_TEST(test_outdated_record_is_ignored);
+    RUN_TEST(test_invalid_numbers_are_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,180 @@
+#include <unity.h>
+#include <string.h>
+#include "ShowFormat.h"
+
+const uint16_t kFrames = 200;
+const uint32_t kFrameMicros = 46440; // 2048 samples at 44.1 kHz
+
+ShowFrame frames[kFrames];
+uint8_t show[kShowHeaderSize + kFrames * kShowMaxRecordSize];
+size_t recordOffset[kFrames + 1]; // Start of each record in 'show', the last entry is the end
+
+// Synthetic show: small and large changes, beats and a time base that is not a multiple of the 100 us ticks
+static void makeFrames()
+{
+    const int16_t kSteps[] = {1, -1, 7, -7, -8, 8, 40, -120, 255, -255};
+    uint32_t seed = 1;
+
+    memset(frames, 0, sizeof(frames));
+
+    for (uint16_t f = 0; f < kFrames; f++)
+    {
+        ShowFrame &frame = frames[f];
+
+        frame.timeMicros = 1000000 + f * kFrameMicros + (f * 37) % 97;
+        frame.isBeat = (f % 11) == 0;
+
+        for (uint8_t band = 0; band < kShowBandCount; band++)
+        {
+            int16_t level = (f > 0) ? frames[f - 1].lightness[band] : 128;
+
+            seed = seed * 1664525 + 1013904223;
+
+            // About half of the bands change each frame, some by more than a nibble can hold
+            if ((seed >> 24) & 1)
+            {
+                level += kSteps[(seed >> 16) % (sizeof(kSteps) / sizeof(kSteps[0]))];
+            }
+
+            frame.lightness[band] = level < 0 ? 0 : (level > 255 ? 255 : level);
+        }
+    }
+}
+
+static size_t encodeShow()
+{
+    ShowEncoder encoder;
+    size_t length = encoder.begin(show, sizeof(show));
+
+    for (uint16_t f = 0; f < kFrames; f++)
+    {
+        recordOffset[f] = length;
+        length += encoder.encode(frames[f], show + length, sizeof(show) - length);
+    }
+
+    recordOffset[kFrames] = length;
+
+    return length;
+}
+
+void setUp()
+{
+    makeFrames();
+}
+
+void tearDown() {}
+
+void test_round_trip()
+{
+    size_t length = encodeShow();
+    uint16_t escapes = 0;
+
+    ShowDecoder decoder;
+    size_t offset = decoder.begin(show, length);
+
+    TEST_ASSERT_EQUAL(kShowHeaderSize, offset);
+    TEST_ASSERT_EQUAL(kShowKeyframeInterval, decoder.keyframeInterval());
+
+    for (uint16_t f = 0; f < kFrames; f++)
+    {
+        ShowFrame decoded;
+        size_t recordLength = decoder.decode(show + offset, length - offset, decoded);
+
+        TEST_ASSERT_EQUAL(recordOffset[f + 1] - recordOffset[f], recordLength);
+        TEST_ASSERT_FALSE(decoder.isCorrupt);
+
+        // Every K-th record is a keyframe, starting with the first
+        bool isKeyframe = show[offset] & kShowFlagKeyframe;
+        TEST_ASSERT_EQUAL(f % kShowKeyframeInterval == 0, isKeyframe);
+
+        TEST_ASSERT_EQUAL_MEMORY(frames[f].lightness, decoded.lightness, kShowBandCount);
+        TEST_ASSERT_EQUAL(frames[f].isBeat, decoded.isBeat);
+
+        // Times count from the first frame and never drift by more than half a tick
+        TEST_ASSERT_UINT32_WITHIN(50, frames[f].timeMicros - frames[0].timeMicros, decoded.timeMicros);
+
+        for (uint8_t band = 0; f > 0 && !isKeyframe && band < kShowBandCount; band++)
+        {
+            int16_t delta = frames[f].lightness[band] - frames[f - 1].lightness[band];
+
+            // Zigzag codes of 16 and more need the escape
+            if (delta >= 8 || delta < -8)
+                escapes++;
+        }
+
+        offset += recordLength;
+    }
+
+    TEST_ASSERT_EQUAL(length, offset);
+    TEST_ASSERT_GREATER_THAN(100, escapes);
+}
+
+// A record cut short, e.g. at the end of a file that is still written, is not an error
+void test_incomplete_records_are_not_corrupt()
+{
+    encodeShow();
+
+    const uint8_t *keyframe = show + recordOffset[0];
+    const uint8_t *delta = show + recordOffset[1];
+    size_t keyframeLength = recordOffset[1] - recordOffset[0];
+    size_t deltaLength = recordOffset[2] - recordOffset[1];
+
+    ShowDecoder decoder;
+    ShowFrame decoded;
+
+    TEST_ASSERT_EQUAL(0, decoder.begin(show, kShowHeaderSize - 1));
+    TEST_ASSERT_FALSE(decoder.isCorrupt);
+    TEST_ASSERT_EQUAL(kShowHeaderSize, decoder.begin(show, kShowHeaderSize));
+
+    for (size_t length = 0; length < keyframeLength; length++)
+    {
+        TEST_ASSERT_EQUAL(0, decoder.decode(keyframe, length, decoded));
+        TEST_ASSERT_FALSE(decoder.isCorrupt);
+    }
+
+    TEST_ASSERT_EQUAL(keyframeLength, decoder.decode(keyframe, keyframeLength, decoded));
+
+    for (size_t length = 0; length < deltaLength; length++)
+    {
+        TEST_ASSERT_EQUAL(0, decoder.decode(delta, length, decoded));
+        TEST_ASSERT_FALSE(decoder.isCorrupt);
+    }
+
+    // The failed attempts left the state alone, the complete record still decodes
+    TEST_ASSERT_EQUAL(deltaLength, decoder.decode(delta, deltaLength, decoded));
+    TEST_ASSERT_EQUAL_MEMORY(frames[1].lightness, decoded.lightness, kShowBandCount);
+}
+
+void test_damaged_records_are_corrupt()
+{
+    encodeShow();
+
+    ShowDecoder decoder;
+    ShowFrame decoded;
+
+    // A delta record with no keyframe before it
+    TEST_ASSERT_EQUAL(kShowHeaderSize, decoder.begin(show, kShowHeaderSize));
+    TEST_ASSERT_EQUAL(0, decoder.decode(show + recordOffset[1], recordOffset[2] - recordOffset[1], decoded));
+    TEST_ASSERT_TRUE(decoder.isCorrupt);
+
+    // A time longer than 4 bytes
+    const uint8_t overlong[] = {kShowFlagKeyframe, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+    TEST_ASSERT_EQUAL(kShowHeaderSize, decoder.begin(show, kShowHeaderSize));
+    TEST_ASSERT_FALSE(decoder.isCorrupt);
+    TEST_ASSERT_EQUAL(0, decoder.decode(overlong, sizeof(overlong), decoded));
+    TEST_ASSERT_TRUE(decoder.isCorrupt);
+
+    // Another magic
+    show[0] ^= 0x20;
+    TEST_ASSERT_EQUAL(0, decoder.begin(show, kShowHeaderSize));
+    TEST_ASSERT_TRUE(decoder.isCorrupt);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_incomplete_records_are_not_corrupt);
+    RUN_TEST(test_damaged_records_are_corrupt);
+    return UNITY_END();
+}
@@ -0,0 +1,61 @@
+#include <unity.h>
+#include <math.h>
+#include "SilenceDetector.h"
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_floor_rise_independent_of_block_size()
+{
+    SilenceDetector buffers;
+    SilenceDetector blocks;
+    uint32_t nowMillis = 0;
+
+    buffers.update(10.0f, 512, nowMillis);
+    blocks.update(10.0f, 4096, nowMillis);
+
+    // One minute of louder input: 512 sample DMA buffers in idle mode, 4096 sample blocks when active
+    for (uint16_t block = 0; block < 646; block++)
+    {
+        for (uint8_t buffer = 0; buffer < 8; buffer++)
+        {
+            buffers.update(100.0f, 512, nowMillis);
+        }
+
+        blocks.update(100.0f, 4096, nowMillis);
+        nowMillis += 93;
+    }
+
+    TEST_ASSERT_FLOAT_WITHIN(0.01f * blocks.noiseFloor(), blocks.noiseFloor(), buffers.noiseFloor());
+
+    // 1.0005 per 2048 samples for a minute
+    TEST_ASSERT_FLOAT_WITHIN(0.5f, 10.0f * powf(1.0005f, 1292), blocks.noiseFloor());
+}
+
+void test_silence_after_hold_time()
+{
+    SilenceDetector detector;
+    uint32_t nowMillis = 0;
+
+    detector.update(50.0f, 512, nowMillis);
+
+    while (nowMillis < detector.holdMillis)
+    {
+        TEST_ASSERT_FALSE(detector.update(50.0f, 512, nowMillis));
+        nowMillis += 12;
+    }
+
+    TEST_ASSERT_TRUE(detector.update(50.0f, 512, nowMillis));
+
+    // The first loud block ends the silence
+    TEST_ASSERT_FALSE(detector.update(5000.0f, 2048, nowMillis));
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_floor_rise_independent_of_block_size);
+    RUN_TEST(test_silence_after_hold_time);
+    return UNITY_END();
+}
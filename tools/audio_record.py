@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""Record or decode the lossless raw-audio stream of the LogRawAudio build into a WAV file.
+
+Usage:
+  audio_record.py --port /dev/ttyUSB0 [--baud 1500000] [--seconds 60] output.wav
+  audio_record.py --input capture.bin output.wav
+
+The frame format is documented in include/AudioCapture.h. Other bytes on the
+port (telemetry frames, log text) are skipped. Missing blocks, detected from
+the sequence numbers, are filled with silence so the timing stays intact.
+Recording from a port requires pyserial.
+"""
+
+import argparse
+import struct
+import sys
+import time
+import wave
+
+SYNC = b"\xa5\xc3"
+TYPE_BLOCK = 2
+HEADER_SIZE = 19
+RICE_ESCAPE = 24
+SAMPLE_RATE = 44100
+CODING_RICE = 0
+CODING_VERBATIM = 1
+MAX_GAP_BLOCKS = 1000
+
+
+def crc16_ccitt(data, crc=0xFFFF):
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+class BitReader:
+    def __init__(self, data):
+        self.value = int.from_bytes(data, "big")
+        self.remaining = len(data) * 8
+
+    def read(self, count):
+        if count > self.remaining:
+            raise ValueError("bitstream exhausted")
+        self.remaining -= count
+        return (self.value >> self.remaining) & ((1 << count) - 1)
+
+    def read_unary(self, limit):
+        q = 0
+        while q < limit and self.read(1):
+            q += 1
+        return q
+
+
+def decode_samples(coding, k, count, first, data):
+    samples = [first]
+    if coding == CODING_VERBATIM:
+        samples += list(struct.unpack_from("<%dh" % (count - 1), data, 0))
+        return samples
+
+    reader = BitReader(data)
+    prev = first
+    for _ in range(count - 1):
+        q = reader.read_unary(RICE_ESCAPE)
+        if q == RICE_ESCAPE:
+            u = reader.read(17)
+        else:
+            u = (q << k) | reader.read(k)
+        delta = (u >> 1) ^ -(u & 1)
+        prev = ((prev + delta + 0x8000) & 0xFFFF) - 0x8000
+        samples.append(prev)
+    return samples
+
+
+def parse_blocks(data):
+    """Yield (sequence, timestamp, samples) and return the unparsed remainder via StopIteration."""
+    pos = 0
+    while True:
+        pos = data.find(SYNC, pos)
+        if pos < 0 or pos + 5 > len(data):
+            return data[pos:] if pos >= 0 else b""
+        frame_type = data[pos + 2]
+        (length,) = struct.unpack_from("<H", data, pos + 3)
+        end = pos + 5 + length + 2
+        if frame_type != TYPE_BLOCK:
+            pos += 1
+            continue
+        if end > len(data):
+            return data[pos:]
+        (crc,) = struct.unpack_from("<H", data, pos + 5 + length)
+        if crc16_ccitt(data[pos + 2:pos + 5 + length]) != crc:
+            pos += 1
+            continue
+        seq, timestamp, count, coding, k, first = struct.unpack_from("<IIHBBh", data, pos + 5)
+        yield seq, timestamp, decode_samples(coding, k, count, first, data[pos + HEADER_SIZE:pos + 5 + length])
+        pos = end
+
+
+class Recorder:
+    def __init__(self, path):
+        self.wav = wave.open(path, "wb")
+        self.wav.setnchannels(1)
+        self.wav.setsampwidth(2)
+        self.wav.setframerate(SAMPLE_RATE)
+        self.last_seq = None
+        self.blocks = 0
+        self.lost = 0
+
+    def add(self, seq, samples):
+        if self.last_seq is not None:
+            gap = (seq - self.last_seq - 1) & 0xFFFFFFFF
+            if gap > MAX_GAP_BLOCKS:
+                # Sequence restarted, e.g. after a reset of the device
+                sys.stderr.write("sequence jump %d -> %d, not filled\n" % (self.last_seq, seq))
+            elif gap:
+                self.lost += gap
+                self.wav.writeframes(b"\x00\x00" * len(samples) * gap)
+        self.last_seq = seq
+        self.blocks += 1
+        self.wav.writeframes(struct.pack("<%dh" % len(samples), *samples))
+
+    def close(self):
+        self.wav.close()
+        sys.stderr.write("%d blocks written, %d lost blocks filled with silence\n" % (self.blocks, self.lost))
+
+
+def consume(recorder, buffer):
+    gen = parse_blocks(buffer)
+    while True:
+        try:
+            seq, _, samples = next(gen)
+        except StopIteration as stop:
+            return stop.value or b""
+        recorder.add(seq, samples)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("output")
+    parser.add_argument("--input", help="raw capture file")
+    parser.add_argument("--port", help="serial port of the M5StickC")
+    parser.add_argument("--baud", type=int, default=1500000)
+    parser.add_argument("--seconds", type=float, default=60.0)
+    args = parser.parse_args()
+
+    recorder = Recorder(args.output)
+
+    if args.input:
+        with open(args.input, "rb") as f:
+            consume(recorder, f.read())
+    elif args.port:
+        import serial
+
+        port = serial.Serial(args.port, args.baud, timeout=0.1)
+        pending = b""
+        stop = time.time() + args.seconds
+        while time.time() < stop:
+            pending = consume(recorder, pending + port.read(8192))
+        port.close()
+    else:
+        parser.error("either --input or --port is required")
+
+    recorder.close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,215 @@
+#!/usr/bin/env python3
+"""Write, read and benchmark recorded light shows.
+
+Usage: show_tool.py encode capture.bin out.show
+       show_tool.py decode in.show [output.csv]
+       show_tool.py bench file
+
+'encode' converts a serial capture of binary telemetry frames (see
+telemetry_decode.py) into a show. Copy shows to data/ and upload them with
+'pio run -t uploadfs', then play one with the BLE mode "show <name>".
+'bench' encodes and decodes the frames of a show or capture and prints the
+compression ratio and throughput of this implementation.
+
+The format is documented in include/ShowFormat.h.
+"""
+
+import csv
+import struct
+import sys
+import time
+
+from telemetry_decode import parse_frames
+
+MAGIC = b"LSHW"
+VERSION = 1
+HEADER = struct.Struct("<4sBBH")
+BAND_COUNT = 64
+KEYFRAME_INTERVAL = 32
+FLAG_KEYFRAME = 0x80
+FLAG_BEAT = 0x40
+RAW_FRAME_SIZE = BAND_COUNT + 1 + 4  # Lightness, beat flag and timestamp
+
+
+def zigzag(v):
+    return ((v << 1) ^ (v >> 15)) & 0xFFFF
+
+
+def unzigzag(u):
+    v = (u >> 1) ^ -(u & 1)
+    return ((v + 0x8000) & 0xFFFF) - 0x8000
+
+
+class Encoder:
+    def __init__(self):
+        self.previous = [0] * BAND_COUNT
+        self.encoded_us = None
+        self.since_keyframe = 0
+
+    def header(self):
+        return HEADER.pack(MAGIC, VERSION, BAND_COUNT, KEYFRAME_INTERVAL)
+
+    def encode(self, time_us, beat, bands):
+        is_keyframe = self.encoded_us is None or self.since_keyframe >= KEYFRAME_INTERVAL
+        out = bytearray([(FLAG_KEYFRAME if is_keyframe else 0) | (FLAG_BEAT if beat else 0)])
+
+        # Relative to the previous record as decoded, so rounding never accumulates
+        if self.encoded_us is None:
+            self.encoded_us = time_us
+        ticks = min((((time_us - self.encoded_us) & 0xFFFFFFFF) + 50) // 100, (1 << 28) - 1)
+        self.encoded_us = (self.encoded_us + ticks * 100) & 0xFFFFFFFF
+
+        while True:
+            byte = ticks & 0x7F
+            ticks >>= 7
+            out.append(byte | 0x80 if ticks else byte)
+            if not ticks:
+                break
+
+        if is_keyframe:
+            out += bytes(bands)
+            self.since_keyframe = 1
+        else:
+            mask = bytearray(BAND_COUNT // 8)
+            nibbles = []
+            for band, (value, previous) in enumerate(zip(bands, self.previous)):
+                if value == previous:
+                    continue
+                mask[band >> 3] |= 1 << (band & 7)
+                code = zigzag(value - previous)
+                nibbles += [code] if code < 16 else [0, code >> 8, (code >> 4) & 0x0F, code & 0x0F]
+            if len(nibbles) & 1:
+                nibbles.append(0)
+            out += mask
+            out += bytes((nibbles[i] << 4) | nibbles[i + 1] for i in range(0, len(nibbles), 2))
+            self.since_keyframe += 1
+
+        self.previous = list(bands)
+        return bytes(out)
+
+
+def decode(data):
+    """Yield (time_us, beat, bands) for every frame of a show."""
+    if len(data) < HEADER.size:
+        raise ValueError("not a show file")
+    magic, version, band_count, _ = HEADER.unpack_from(data, 0)
+    if magic != MAGIC or version != VERSION or band_count != BAND_COUNT:
+        raise ValueError("unsupported show file")
+
+    pos = HEADER.size
+    time_us = 0
+    previous = None
+
+    while pos < len(data):
+        flags = data[pos]
+        pos += 1
+        ticks = 0
+        shift = 0
+        while True:
+            byte = data[pos]
+            pos += 1
+            ticks |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+
+        if flags & FLAG_KEYFRAME:
+            bands = list(data[pos:pos + BAND_COUNT])
+            pos += BAND_COUNT
+        else:
+            if previous is None:
+                raise ValueError("delta frame before the first keyframe")
+            mask = data[pos:pos + BAND_COUNT // 8]
+            pos += BAND_COUNT // 8
+            nibble = 0
+
+            def read():
+                nonlocal nibble
+                value = data[pos + (nibble >> 1)]
+                value = value >> 4 if nibble & 1 == 0 else value & 0x0F
+                nibble += 1
+                return value
+
+            bands = list(previous)
+            for band in range(BAND_COUNT):
+                if mask[band >> 3] & (1 << (band & 7)):
+                    code = read()
+                    if code == 0:
+                        code = (read() << 8) | (read() << 4) | read()
+                    bands[band] = (bands[band] + unzigzag(code)) & 0xFF
+            pos += (nibble + 1) >> 1
+
+        time_us += ticks * 100
+        previous = bands
+        yield time_us, bool(flags & FLAG_BEAT), bands
+
+
+def read_frames(path):
+    """Frames of a show or a telemetry capture as (time_us, beat, bands)."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data.startswith(MAGIC):
+        return list(decode(data))
+    return [(frame["timestamp_us"], frame["beat"], frame["bands"])
+            for frame in parse_frames(data) if len(frame["bands"]) == BAND_COUNT]
+
+
+def encode_file(frames, path):
+    encoder = Encoder()
+    with open(path, "wb") as f:
+        f.write(encoder.header())
+        for frame in frames:
+            f.write(encoder.encode(*frame))
+
+
+def main():
+    if len(sys.argv) < 3 or sys.argv[1] not in ("encode", "decode", "bench"):
+        sys.stderr.write(__doc__)
+        return 1
+
+    command = sys.argv[1]
+
+    if command == "encode":
+        if len(sys.argv) < 4:
+            sys.stderr.write(__doc__)
+            return 1
+        frames = read_frames(sys.argv[2])
+        encode_file(frames, sys.argv[3])
+        sys.stderr.write("%d frames written\n" % len(frames))
+
+    elif command == "decode":
+        with open(sys.argv[2], "rb") as f:
+            data = f.read()
+        out = open(sys.argv[3], "w", newline="") if len(sys.argv) > 3 else sys.stdout
+        writer = csv.writer(out)
+        writer.writerow(["time_us", "beat"] + ["band%d" % i for i in range(BAND_COUNT)])
+        for time_us, beat, bands in decode(data):
+            writer.writerow([time_us, int(beat)] + bands)
+
+    else:
+        frames = read_frames(sys.argv[2])
+        if not frames:
+            sys.stderr.write("no frames\n")
+            return 1
+
+        encoder = Encoder()
+        start = time.perf_counter()
+        data = encoder.header() + b"".join(encoder.encode(*frame) for frame in frames)
+        encode_s = time.perf_counter() - start
+
+        start = time.perf_counter()
+        decoded = list(decode(data))
+        decode_s = time.perf_counter() - start
+
+        mismatches = sum(1 for a, b in zip(frames, decoded) if a[1] != b[1] or list(a[2]) != b[2])
+        raw = len(frames) * RAW_FRAME_SIZE
+        print("%d frames, %d -> %d bytes, ratio %.2f, %d mismatches"
+              % (len(frames), raw, len(data), raw / len(data), mismatches))
+        print("Encode %.2f MB/s, decode %.2f MB/s"
+              % (raw / encode_s / 1e6, raw / decode_s / 1e6))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""Convert a raw serial capture of binary telemetry frames into CSV.
+
+Usage: telemetry_decode.py capture.bin [output.csv]
+
+The frame format is documented in include/Telemetry.h. Bytes between frames
+(e.g. log text) are skipped, frames with a bad CRC are dropped and gaps in the
+sequence numbers are reported on stderr. Band gain frames are merged into the
+analysis frames that follow them as gain columns.
+"""
+
+import csv
+import struct
+import sys
+
+SYNC = b"\xa5\x5a"
+TYPE_ANALYSIS = 1
+TYPE_GAINS = 3
+STAGES = ["i2s", "cond", "fft", "spec", "bands", "beat", "fx", "out", "show", "frame"]
+
+
+def crc16_ccitt(data, crc=0xFFFF):
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def parse_frames(data):
+    """Yield decoded analysis frames as dicts with the last band gains received."""
+    pos = 0
+    bad = 0
+    gains = None
+    while True:
+        pos = data.find(SYNC, pos)
+        if pos < 0 or pos + 4 > len(data):
+            break
+        frame_type = data[pos + 2]
+        length = data[pos + 3]
+        end = pos + 4 + length + 2
+        if end > len(data):
+            break
+        body = data[pos + 2:pos + 4 + length]
+        (crc,) = struct.unpack_from("<H", data, pos + 4 + length)
+        if frame_type not in (TYPE_ANALYSIS, TYPE_GAINS) or crc16_ccitt(body) != crc:
+            bad += 1
+            pos += 1
+            continue
+
+        payload = data[pos + 4:pos + 4 + length]
+
+        if frame_type == TYPE_GAINS:
+            _, band_count = struct.unpack_from("<HB", payload, 0)
+            gains = [g / 256.0 for g in struct.unpack_from("<%dH" % band_count, payload, 3)]
+            pos = end
+            continue
+
+        seq, timestamp, sensitivity, magnitude_sum, flags, band_count = struct.unpack_from("<HIffBB", payload, 0)
+        offset = 16
+        bands = list(payload[offset:offset + band_count])
+        offset += band_count
+        stage_count = payload[offset]
+        offset += 1
+        stages = list(struct.unpack_from("<%dH" % stage_count, payload, offset))
+
+        yield {
+            "seq": seq,
+            "timestamp_us": timestamp,
+            "sensitivity": sensitivity,
+            "magnitude_sum": magnitude_sum,
+            "beat": flags & 1,
+            "bands": bands,
+            "stages": stages,
+            "gains": gains,
+        }
+        pos = end
+
+    if bad:
+        sys.stderr.write("%d corrupt frames skipped\n" % bad)
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.stderr.write(__doc__)
+        return 1
+
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+
+    out = open(sys.argv[2], "w", newline="") if len(sys.argv) > 2 else sys.stdout
+    writer = None
+    last_seq = None
+    lost = 0
+
+    for frame in parse_frames(data):
+        if writer is None:
+            header = ["seq", "timestamp_us", "sensitivity", "magnitude_sum", "beat"]
+            header += ["band%d" % i for i in range(len(frame["bands"]))]
+            header += ["t_%s_us" % (STAGES[i] if i < len(STAGES) else str(i)) for i in range(len(frame["stages"]))]
+            header += ["gain%d" % i for i in range(len(frame["bands"]))]
+            writer = csv.writer(out)
+            writer.writerow(header)
+
+        if last_seq is not None:
+            lost += (frame["seq"] - last_seq - 1) & 0xFFFF
+        last_seq = frame["seq"]
+
+        # Gain columns stay empty until the first band gain frame
+        gains = frame["gains"]
+        gains = ["%.3f" % g for g in gains] if gains is not None else [""] * len(frame["bands"])
+
+        writer.writerow([frame["seq"], frame["timestamp_us"], "%.3f" % frame["sensitivity"],
+                         "%.3f" % frame["magnitude_sum"], frame["beat"]] + frame["bands"] + frame["stages"] + gains)
+
+    if lost:
+        sys.stderr.write("%d frames lost (sequence gaps)\n" % lost)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())